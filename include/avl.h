@@ -0,0 +1,32 @@
+#ifndef AVL_H
+#define AVL_H
+
+#include <stddef.h>
+
+/*
+ * Intrusive AVL tree
+ * The node is embedded in the indexed struct, avl_entry() gets back to
+ * the container. An optional update callback recomputes per-node
+ * augmented data (e.g. subtree max) from the children after every
+ * structural change.
+ */
+struct avl_node {
+	struct avl_node *avl_left;
+	struct avl_node *avl_right;
+	int avl_height;
+};
+
+#define avl_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+typedef int (*avl_cmp_t)(const struct avl_node *a, const struct avl_node *b);
+typedef void (*avl_update_t)(struct avl_node *node);
+
+void avl_insert(struct avl_node **root, struct avl_node *node,
+		avl_cmp_t cmp, avl_update_t update);
+void avl_erase(struct avl_node **root, struct avl_node *node,
+		avl_cmp_t cmp, avl_update_t update);
+struct avl_node *avl_first(struct avl_node *root);
+struct avl_node *avl_last(struct avl_node *root);
+
+#endif
@@ -28,7 +28,10 @@ enum ins_opcode_t {
 	ALLOC,	// Allocate memory
 	FREE,	// Deallocated a memory block
 	READ,	// Write data to a byte on memory
-	WRITE	// Read data from a byte on memory
+	WRITE,	// Read data from a byte on memory
+	SHMGET,	// Create a shared memory segment
+	SHMAT,	// Attach a shared memory segment as a region
+	SHMDT	// Detach a shared memory segment
 };
 
 /* instructions executed by the CPU */
@@ -83,6 +86,7 @@ struct pcb_t {
 	struct memphy_struct *mram;
 	struct memphy_struct **mswp;
 	struct memphy_struct *active_mswp;
+	struct mm_arena arena; // Backs mm and all its bookkeeping
 #endif
 	struct page_table_t * page_table; // Page table
 	uint32_t bp;	// Break pointer
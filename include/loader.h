@@ -5,5 +5,7 @@
 
 struct pcb_t * load(const char * path);
 
+void unload(struct pcb_t * proc);
+
 #endif
 
@@ -3,64 +3,99 @@
 #include "bitops.h"
 #include "common.h"
 
-/* CPU Bus definition */
-#define PAGING_CPU_BUS_WIDTH 22 /* 22bit bus - MAX SPACE 4MB */
-#define PAGING_PAGESZ  256      /* 256B or 8-bits PAGE NUMBER */
-#define PAGING_MEMRAMSZ BIT(10) /* 1MB */
-#define PAGING_PAGE_ALIGNSZ(sz) (DIV_ROUND_UP(sz,PAGING_PAGESZ)*PAGING_PAGESZ)
+/* CPU Bus and page size, set at start up from the config (paging_setup).
+ * Page sizes are powers of two, every address split is a shift or a mask
+ * of the precomputed geometry */
+#define PAGING_DEFAULT_BUS_WIDTH 22 /* 22bit bus - MAX SPACE 4MB */
+#define PAGING_DEFAULT_PAGESZ   256 /* 256B or 8-bits PAGE NUMBER */
+#define PAGING_MIN_PAGESZ        64
+#define PAGING_MAX_PAGESZ  BIT(16)
+#define PAGING_MAX_PGN_BITS      24 /* the page table is one flat array */
+#ifdef MM_64BIT
+#define PAGING_MAX_BUS_WIDTH     40
+#else
+#define PAGING_MAX_BUS_WIDTH     30 /* addresses stay positive ints */
+#endif
 
-#define PAGING_MEMSWPSZ BIT(14) /* 16MB */
-#define PAGING_SWPFPN_OFFSET 5  
-#define PAGING_MAX_PGN  (DIV_ROUND_UP(BIT(PAGING_CPU_BUS_WIDTH),PAGING_PAGESZ))
+#define PAGING_CPU_BUS_WIDTH (paging.bus_width)
+#define PAGING_ADDR_SPACE ((addr_t)1 << PAGING_CPU_BUS_WIDTH)
+#define PAGING_PAGESZ  (paging.pagesz)
+#define PAGING_PAGE_SHIFT (paging.page_shift)
+#define PAGING_PAGE_ALIGNSZ(sz) (((sz) + PAGING_PAGESZ - 1) & ~(PAGING_PAGESZ - 1))
+#define PAGING_MAX_PGN  (paging.max_pgn)
+extern struct paging_geom paging;
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
-/* PTE BIT */
-#define PAGING_PTE_PRESENT_MASK BIT(31) 
-#define PAGING_PTE_SWAPPED_MASK BIT(30)
-#define PAGING_PTE_RESERVE_MASK BIT(29)
-#define PAGING_PTE_DIRTY_MASK BIT(28)
-#define PAGING_PTE_EMPTY01_MASK BIT(14)
-#define PAGING_PTE_EMPTY02_MASK BIT(13)
+
+/* VM areas: the address space is cut in PAGING_MAX_VMA equal spans,
+ * area i starts at the bottom of span i and grows upward
+ * (0: heap, 1: stack, 2-3: mmap-style areas) */
+#define VMA_HEAP  0
+#define VMA_STACK 1
+#define VMA_MMAP  2
+#define PAGING_VMA_SPAN (PAGING_ADDR_SPACE / PAGING_MAX_VMA)
+#define PAGING_VMA_BASE(vmaid) ((vmaid) * PAGING_VMA_SPAN)
+
+/* Devices from this size up reserve their storage without committing it */
+#define MEMPHY_NORESERVE_MIN (4 << 20)
+/* Rounds over the used list while every owner is busy in its own fault */
+#define MM_CLAIM_RETRY 64
+/* PTE BIT, the flags take the top bits of a pte_t */
+#ifdef MM_64BIT
+#define PTE_BIT(nr) BIT_ULL(nr)
+#define PTE_GENMASK(h,l) GENMASK_ULL(h,l)
+#define PAGING_PTE_FLAG_LOBIT 59
+#else
+#define PTE_BIT(nr) BIT(nr)
+#define PTE_GENMASK(h,l) GENMASK(h,l)
+#define PAGING_PTE_FLAG_LOBIT 27
+#endif
+#define PAGING_PTE_PRESENT_MASK PTE_BIT(PAGING_PTE_FLAG_LOBIT + 4)
+#define PAGING_PTE_SWAPPED_MASK PTE_BIT(PAGING_PTE_FLAG_LOBIT + 3)
+#define PAGING_PTE_SHARED_MASK PTE_BIT(PAGING_PTE_FLAG_LOBIT + 2) /* page of a shared memory segment */
+#define PAGING_PTE_DIRTY_MASK PTE_BIT(PAGING_PTE_FLAG_LOBIT + 1)
+#define PAGING_PTE_COW_MASK PTE_BIT(PAGING_PTE_FLAG_LOBIT) /* merged page, copied on write (mm-ksm.c) */
 
 /* PTE BIT PRESENT */
 #define PAGING_PTE_SET_PRESENT(pte) (pte=pte|PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_PRESENT(pte) (pte&PAGING_PTE_PRESENT_MASK)
+#define PAGING_PAGE_SWAPPED(pte) (pte&PAGING_PTE_SWAPPED_MASK)
 
-/* USRNUM */
-#define PAGING_PTE_USRNUM_LOBIT 15
-#define PAGING_PTE_USRNUM_HIBIT 27
-/* FPN */
+/* FPN, as wide as the MEMRAM frames need, up to the flag bits. Frame
+ * numbers and swap slots are ints, 31 bits at most */
 #define PAGING_PTE_FPN_LOBIT 0
-#define PAGING_PTE_FPN_HIBIT 12
+#ifdef MM_64BIT
+#define PAGING_PTE_FPN_MAXBITS 31
+#else
+#define PAGING_PTE_FPN_MAXBITS 27
+#endif
 /* SWPTYP */
 #define PAGING_PTE_SWPTYP_LOBIT 0
 #define PAGING_PTE_SWPTYP_HIBIT 4
 /* SWPOFF */
 #define PAGING_PTE_SWPOFF_LOBIT 5
+#ifdef MM_64BIT
+#define PAGING_PTE_SWPOFF_HIBIT 35
+#else
 #define PAGING_PTE_SWPOFF_HIBIT 25
+#endif
 
 /* PTE masks */
-#define PAGING_PTE_USRNUM_MASK GENMASK(PAGING_PTE_USRNUM_HIBIT,PAGING_PTE_USRNUM_LOBIT)
-#define PAGING_PTE_FPN_MASK    GENMASK(PAGING_PTE_FPN_HIBIT,PAGING_PTE_FPN_LOBIT)
-#define PAGING_PTE_SWPTYP_MASK GENMASK(PAGING_PTE_SWPTYP_HIBIT,PAGING_PTE_SWPTYP_LOBIT)
-#define PAGING_PTE_SWPOFF_MASK GENMASK(PAGING_PTE_SWPOFF_HIBIT,PAGING_PTE_SWPOFF_LOBIT)
+#define PAGING_PTE_FPN_MASK    (paging.pte_fpn_mask)
+#define PAGING_PTE_SWPTYP_MASK PTE_GENMASK(PAGING_PTE_SWPTYP_HIBIT,PAGING_PTE_SWPTYP_LOBIT)
+#define PAGING_PTE_SWPOFF_MASK PTE_GENMASK(PAGING_PTE_SWPOFF_HIBIT,PAGING_PTE_SWPOFF_LOBIT)
 
 /* OFFSET */
 #define PAGING_ADDR_OFFST_LOBIT 0
-#define PAGING_ADDR_OFFST_HIBIT (NBITS(PAGING_PAGESZ) - 1)
 
 /* PAGE Num */
-#define PAGING_ADDR_PGN_LOBIT NBITS(PAGING_PAGESZ)
-#define PAGING_ADDR_PGN_HIBIT (PAGING_CPU_BUS_WIDTH - 1)
+#define PAGING_ADDR_PGN_LOBIT PAGING_PAGE_SHIFT
 
 /* Frame PHY Num */
-#define PAGING_ADDR_FPN_LOBIT NBITS(PAGING_PAGESZ)
-#define PAGING_ADDR_FPN_HIBIT (NBITS(PAGING_MEMRAMSZ) - 1)
+#define PAGING_ADDR_FPN_LOBIT PAGING_PAGE_SHIFT
 
 /* SWAPFPN */
-#define PAGING_SWP_LOBIT NBITS(PAGING_PAGESZ)
-#define PAGING_SWP_HIBIT (NBITS(PAGING_MEMSWPSZ) - 1)
-#define PAGING_SWP(pte) ((pte&PAGING_SWP_MASK) >> PAGING_SWPFPN_OFFSET)
+#define PAGING_SWP(pte) GETVAL(pte,PAGING_PTE_SWPOFF_MASK,PAGING_PTE_SWPOFF_LOBIT)
 
 /* Value operators */
 #define SETBIT(v,mask) (v=v|mask)
@@ -70,56 +105,138 @@
 #define GETVAL(v,mask,offst) ((v&mask)>>offst)
 
 /* Other masks */
-#define PAGING_OFFST_MASK  GENMASK(PAGING_ADDR_OFFST_HIBIT,PAGING_ADDR_OFFST_LOBIT)
-#define PAGING_PGN_MASK  GENMASK(PAGING_ADDR_PGN_HIBIT,PAGING_ADDR_PGN_LOBIT)
-#define PAGING_FPN_MASK  GENMASK(PAGING_ADDR_FPN_HIBIT,PAGING_ADDR_FPN_LOBIT)
-#define PAGING_SWP_MASK  GENMASK(PAGING_SWP_HIBIT,PAGING_SWP_LOBIT)
+#define PAGING_OFFST_MASK  (paging.offst_mask)
+#define PAGING_PGN_MASK  (paging.pgn_mask)
 
 /* Extract OFFSET */
-//#define PAGING_OFFST(x)  ((x&PAGING_OFFST_MASK) >> PAGING_ADDR_OFFST_LOBIT)
 #define PAGING_OFFST(x)  GETVAL(x,PAGING_OFFST_MASK,PAGING_ADDR_OFFST_LOBIT)
 /* Extract Page Number*/
 #define PAGING_PGN(x)  GETVAL(x,PAGING_PGN_MASK,PAGING_ADDR_PGN_LOBIT)
-/* Extract FramePHY Number*/
-#define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_ADDR_FPN_LOBIT)
-/* Extract SWAPFPN */
-#define PAGING_PGN(x)  GETVAL(x,PAGING_PGN_MASK,PAGING_ADDR_PGN_LOBIT)
-/* Extract SWAPTYPE */
-#define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_ADDR_FPN_LOBIT)
+/* Extract FPN of an online PTE */
+#define PAGING_PTE_FPN(pte)  GETVAL(pte,PAGING_PTE_FPN_MASK,PAGING_PTE_FPN_LOBIT)
+/* Extract SWAPTYPE of a swapped PTE */
+#define PAGING_PTE_SWPTYP(pte)  GETVAL(pte,PAGING_PTE_SWPTYP_MASK,PAGING_PTE_SWPTYP_LOBIT)
 
 /* Memory range operator */
 #define INCLUDE(x1,x2,y1,y2) (((y1-x1)*(x2-y2)>=0)?1:0)
 #define OVERLAP(x1,x2,y1,y2) (((y2-x1)*(x2-y1)>=0)?1:0)
 
+/* Free region fit policy */
+#define VMRG_FIRSTFIT 0
+#define VMRG_BESTFIT  1
+#ifdef MM_VMRG_BESTFIT
+#define VMRG_FIT VMRG_BESTFIT
+#else
+#define VMRG_FIT VMRG_FIRSTFIT
+#endif
+
+/* Swap placement policies over the MEMSWP devices */
+#define SWP_POLICY_RR   0 /* round-robin */
+#define SWP_POLICY_FREE 1 /* device with most free slots */
+#define SWP_POLICY_TIER 2 /* fastest device first, cold pages demoted */
+
+/* What a frame request does once RAM and swap are exhausted (mm-oom.c) */
+#define OOM_POLICY_FAIL    0 /* the request fails */
+#define OOM_POLICY_LARGEST 1 /* kill the process holding the most pages */
+#define OOM_POLICY_PRIO    2 /* kill the lowest priority process */
+
+/* Time slots per load control window, unless configured (mm-loadctl.c) */
+#define LOADCTL_WINDOW 8
+
+/* Largest swap readahead window, in pages */
+#define SWAP_RA_MAX 32
+
+/* SWPTYP of a page kept in the compressed cache (mm-zswap.c) */
+#define PAGING_SWPTYP_ZSWAP 31
+
+/* SWPTYP of a shared memory page not mapped by this PTE (mm-shm.c), the
+ * SWPOFF names the segment and the page in it */
+#define PAGING_SWPTYP_SHM 30
+#define SHM_MAX_SEG  32
+#define SHM_IDX_BITS 16
+#define SHM_OFF(id, idx) (((id) << SHM_IDX_BITS) | (idx))
+#define SHM_OFF_ID(off)  ((off) >> SHM_IDX_BITS)
+#define SHM_OFF_IDX(off) ((off) & (BIT(SHM_IDX_BITS) - 1))
+
 /* VM region prototypes */
-struct vm_rg_struct * init_vm_rg(int rg_start, int rg_endi);
 int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode);
-int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
-int vmap_page_range(struct pcb_t *caller, int addr, int pgnum, 
+int vmap_page_range(struct pcb_t *caller, addr_t addr, int pgnum, 
                     struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
-int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
+int vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t send, addr_t mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
 int alloc_pages_range(struct pcb_t *caller, int incpgnum, struct framephy_struct **frm_lst);
+int alloc_frame(struct pcb_t *caller, int *retfpn);
+int alloc_frame_may_oom(struct pcb_t *caller, int *retfpn);
+int swap_out_victim(struct pcb_t *caller, int *retfpn);
+int swap_out_local(struct pcb_t *caller, int *retfpn);
+int swap_out_mm(struct pcb_t *caller, int nr);
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn) ;
-int pte_set_fpn(uint32_t *pte, int fpn);
-int pte_set_swap(uint32_t *pte, int swptyp, int swpoff);
-int init_pte(uint32_t *pte,
+int pte_set_fpn(pte_t *pte, int fpn);
+int pte_set_swap(pte_t *pte, int swptyp, int swpoff);
+int init_pte(pte_t *pte,
              int pre,    // present
              int fpn,    // FPN
              int drt,    // dirty
              int swp,    // swap
              int swptyp, // swap type
              int swpoff); //swap offset
-int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr);
+int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, addr_t *alloc_addr);
 int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+int paging_setup(int pagesz, int bus_width, int ramsz);
+int mm_claim(struct mm_struct *mm, struct mm_struct *self);
+void mm_unclaim(struct mm_struct *mm, struct mm_struct *self);
+
+/* Slab caches and per-process arena of the metadata nodes */
+extern struct kmem_cache vm_rg_cache;
+extern struct kmem_cache freerg_cache;
+extern struct kmem_cache mm_cache;
+extern struct kmem_cache vma_cache;
+extern struct kmem_cache arena_chunk_cache;
+extern struct kmem_cache shm_attach_cache;
+void *kmem_cache_alloc(struct kmem_cache *c);
+void kmem_cache_free(struct kmem_cache *c, void *obj);
+void kmem_cache_free_bulk(struct kmem_cache *c, void *head, void *tail, int n);
+void kmem_cache_drain(void);
+int kmem_cache_dump(void);
+void mm_arena_init(struct mm_arena *a);
+void *mm_arena_alloc(struct mm_arena *a, struct kmem_cache *c);
+void mm_arena_free(struct mm_arena *a, struct kmem_cache *c, void *obj);
+void mm_arena_release(struct mm_arena *a);
+
+/* Free region index prototypes */
+void vm_freerg_init(struct vm_freerg_index *idx, struct mm_arena *arena);
+int vm_freerg_insert(struct vm_freerg_index *idx, addr_t start, addr_t end);
+int vm_freerg_alloc(struct vm_freerg_index *idx, addr_t size, int fit,
+                    struct vm_rg_struct *newrg);
+struct vm_freerg_struct *vm_freerg_last(struct vm_freerg_index *idx);
+struct vm_freerg_struct *vm_freerg_find(struct vm_freerg_index *idx, addr_t addr);
+int print_list_freerg(struct vm_freerg_index *idx);
+
+/* Shared memory prototypes */
+int pgshmget(struct pcb_t *proc, uint32_t key, uint32_t size);
+int pgshmat(struct pcb_t *proc, uint32_t key, uint32_t reg_index, uint32_t vmaid);
+int pgshmdt(struct pcb_t *proc, uint32_t reg_index);
+int shm_detach(struct pcb_t *caller, struct vm_rg_struct *rg);
+int shm_getpage(struct pcb_t *caller, struct mm_struct *mm, int pgn, int *fpn);
+int shm_drop_copy(struct pcb_t *caller, int fpn);
+int shm_claim(int off);
+int shm_swap_out(struct pcb_t *caller, struct framephy_struct *fp);
+void shm_destroy_all(void);
+
+/* Symbol region table prototypes */
+void vm_symtbl_init(struct vm_symtbl *t, int cap);
+struct vm_rg_struct *vm_symtbl_lookup(struct vm_symtbl *t, int rgid);
+struct vm_rg_struct *vm_symtbl_insert(struct vm_symtbl *t, int rgid);
+int vm_symtbl_remove(struct vm_symtbl *t, int rgid);
+void vm_symtbl_destroy(struct vm_symtbl *t);
 
 /* CPUTLB prototypes */
 int tlb_change_all_page_tables_of(struct pcb_t *proc,  struct memphy_struct * mp);
 int tlb_flush_tlb_of(struct pcb_t *proc, struct memphy_struct * mp);
-int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
+int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index, uint32_t vmaid);
 int tlbfree_data(struct pcb_t *proc, uint32_t reg_index);
 int tlbread(struct pcb_t * proc, uint32_t source, uint32_t offset, uint32_t destination) ;
 int tlbwrite(struct pcb_t * proc, BYTE data, uint32_t destination, uint32_t offset);
@@ -131,7 +248,7 @@ int TLBMEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
 int TLBMEMPHY_dump(struct memphy_struct * mp);
 
 /* VM prototypes */
-int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
+int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index, uint32_t vmaid);
 int pgfree_data(struct pcb_t *proc, uint32_t reg_index);
 int pgread(
 		struct pcb_t * proc, // Process executing the instruction
@@ -145,28 +262,104 @@ int pgwrite(
 		uint32_t offset);
 /* Local VM prototypes */
 struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
-int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
+int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, addr_t vmastart, addr_t vmaend);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
+int vma_grow(struct pcb_t *caller, int vmaid, int inc_sz);
 int find_victim_page(struct mm_struct* mm, int *pgn);
+int free_pcb_memph(struct pcb_t *caller);
+int release_mm_pages(struct pcb_t *proc);
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
+struct vm_area_struct *vma_create(struct mm_struct *mm, int vmaid);
+int get_symrg_vmaid(struct mm_struct *mm, int rgid);
 
 /* MEM/PHY protypes */
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
-int MEMPHY_put_usedfp(struct memphy_struct *mp, int fpn, struct mm_struct *owner);
+int MEMPHY_nr_freefp(struct memphy_struct *mp);
+int MEMPHY_put_usedfp(struct memphy_struct *mp, int fpn, struct mm_struct *owner, int pgn);
+struct framephy_struct *MEMPHY_get_frame(struct memphy_struct *mp, int fpn);
 int MEMPHY_remove_usedfp(struct memphy_struct *mp, int fpn);
-struct framephy_struct* MEMPHY_get_usedfp(struct memphy_struct *mp);
+struct framephy_struct* MEMPHY_get_usedfp(struct memphy_struct *mp, struct mm_struct *self,
+                                          struct mm_memcg *memcg);
 int MEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
+int MEMPHY_get_swpslot(struct memphy_struct *mp, int *slot);
+int MEMPHY_dup_swpslot(struct memphy_struct *mp, int slot);
+int MEMPHY_put_swpslot(struct memphy_struct *mp, int slot);
+int MEMPHY_nr_free_swpslot(struct memphy_struct *mp);
+void MEMPHY_free_swpmap(struct memphy_struct *mp);
+int MEMPHY_load_swpmap(struct memphy_struct *mp, const unsigned short *cnt, int hint);
+int MEMPHY_set_swpowner(struct memphy_struct *mp, int slot,
+                        struct mm_struct *mm, int pgn);
+int MEMPHY_get_coldswp(struct memphy_struct *mp, struct mm_struct *self,
+                       int *slot, struct mm_struct **mm, int *pgn);
+int swap_set_policy(const char *name);
+int swap_alloc_slot(struct pcb_t *caller, int *swptyp, int *slot);
+int swap_nr_free(struct pcb_t *caller);
+int swap_free_slot(struct pcb_t *caller, int swptyp, int slot);
+int swap_store_frame(struct pcb_t *caller, int fpn, int dirty, int *swptyp, int *swpoff);
+int swap_out_page(struct pcb_t *caller, struct mm_struct *mm, int pgn, int fpn);
+int swap_in_page(struct pcb_t *caller, pte_t pte, int fpn);
+int swap_drop_copy(struct pcb_t *caller, int fpn);
+int swap_set_readahead(int npages);
+int swap_readahead(struct pcb_t *caller, struct mm_struct *mm, int pgn, pte_t pte);
+void swap_ra_touch(struct memphy_struct *mram, int fpn, int used);
+int swap_ra_dump(void);
+int zswap_init(struct memphy_struct *mram, int pct);
+int zswap_store(struct memphy_struct *mram, int fpn, int *id);
+int zswap_load(int id, int fpn);
+int zswap_dup(int id);
+int zswap_put(int id);
+int zswap_dump(void);
+int kswapd_start(struct kswapd_struct *kd, struct memphy_struct *mram,
+                 struct memphy_struct **mswp, struct timer_id_t *timer_id,
+                 int low, int high);
+int kswapd_stop(struct kswapd_struct *kd);
+int kswapd_join(struct kswapd_struct *kd);
+int ksm_start(struct memphy_struct *mram, struct memphy_struct **mswp,
+              struct timer_id_t *timer_id, int batch);
+int ksm_stop(void);
+int ksm_join(void);
+int ksm_break_cow(struct pcb_t *caller, struct mm_struct *mm, int pgn, int *fpn);
+int ksm_put(struct pcb_t *caller, int fpn);
+int oom_set_policy(const char *name);
+int oom_register(struct pcb_t *proc);
+int oom_unregister(struct pcb_t *proc);
+int oom_killed(struct mm_struct *mm);
+int oom_kill(struct pcb_t *caller);
+int oom_dump(void);
+int memcg_attach(struct pcb_t *proc, int id, int rss_max, int swp_max);
+void memcg_detach(struct mm_struct *mm);
+int memcg_try_charge(struct mm_struct *mm, int type);
+void memcg_charge(struct mm_struct *mm, int nrss, int nswp);
+int memcg_room(struct mm_struct *mm, int type);
+int memcg_evictable(struct framephy_struct *fp, struct mm_memcg *memcg);
+int memcg_query(struct mm_struct *mm, int type, int *usage, int *grpusage, int *max);
+int memcg_dump(void);
+int loadctl_init(int window);
+int loadctl_start(struct memphy_struct *mram, struct memphy_struct **mswp,
+                  struct timer_id_t *timer_id, int high, int low);
+int loadctl_stop(void);
+int loadctl_join(void);
+void loadctl_touch(struct mm_struct *mm, struct memphy_struct *mram, int fpn, int fault);
+void loadctl_exit(struct pcb_t *proc);
+int MEMPHY_read_block(struct memphy_struct *mp, int addr, BYTE *buf, int len);
+int MEMPHY_write_block(struct memphy_struct *mp, int addr, const BYTE *buf, int len);
+int MEMPHY_set_latency(struct memphy_struct *mp, int lat);
+int MEMPHY_zero_frame(struct memphy_struct *mp, int fpn);
+int MEMPHY_copy_frame(struct memphy_struct *mpsrc, int srcfpn,
+                      struct memphy_struct *mpdst, int dstfpn);
 int MEMPHY_dump(struct memphy_struct * mp);
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
+int init_memphy_file(struct memphy_struct *mp, int max_size, int randomflg,
+                     const char *path, int persist);
+int MEMPHY_init_pcp(struct memphy_struct *mp, int ncpus);
+int MEMPHY_destroy(struct memphy_struct *mp);
+void MEMPHY_bind_cpu(int cpu);
 /* DEBUG */
 int print_list_fp(struct framephy_struct *fp);
 int print_list_rg(struct vm_rg_struct *rg);
 int print_list_vma(struct vm_area_struct *rg);
-
-
-int print_list_pgn(struct pgn_t *ip);
-int print_pgtbl(struct pcb_t *ip, uint32_t start, uint32_t end);
+int print_pgtbl(struct pcb_t *ip, addr_t start, addr_t end);
 #endif
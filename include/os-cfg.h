@@ -7,7 +7,9 @@
 #define CPU_TLB
 #define CPUTLB_FIXED_TLBSZ
 #define MM_PAGING
+//#define MM_64BIT
 //#define MM_FIXED_MEMSZ
+//#define MM_VMRG_BESTFIT
 //#define VMDBG 1
 //#define MMDBG 1
 #define IODUMP 1
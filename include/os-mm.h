@@ -3,69 +3,281 @@
 
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
-#define PAGING_MAX_SYMTBL_SZ 30
+#define PAGING_MAX_SYMTBL_SZ 30 /* initial symbol table size, it grows */
+#define PAGING_MAX_VMA 4 /* max number of vm areas per process */
+
+#include <sys/types.h> /* pthread_mutex_t, pthread.h is shadowed by sched.h */
+#include "avl.h"
 
 typedef char BYTE;
-typedef uint32_t addr_t;
 //typedef unsigned int uint32_t;
 
+/* Virtual addresses and page table entries, 64 bits wide with MM_64BIT */
+#ifdef MM_64BIT
+typedef uint64_t addr_t;
+typedef uint64_t pte_t;
+#else
+typedef uint32_t addr_t;
+typedef uint32_t pte_t;
+#endif
+
 struct pgn_t{
    int pgn;
    struct pgn_t *pg_next; 
 };
 
+/*
+ *  Typed cache of fixed-size metadata nodes (mm-slab.c)
+ */
+#define SLAB_MAX_CACHE 8
+#define SLAB_MAG_SIZE  32 /* objects per per-thread magazine */
+#define SLAB_CHUNK     64 /* objects carved per depot growth */
+
+struct kmem_cache {
+   const char *name;
+   size_t objsz;
+   int id;                 /* magazine slot, below SLAB_MAX_CACHE */
+   pthread_mutex_t lock;   /* protects the depot */
+   void *depot;            /* free objects shared by all threads */
+   int nr_depot;
+   int nr_chunk;
+};
+
+/*
+ *  Arena of the MM bookkeeping of one process (mm-slab.c). Objects are
+ *  carved from chunks of the arena cache and recycled per type, the
+ *  chunks go back in one splice when the process exits.
+ */
+#define MM_ARENA_CHUNKSZ 4096
+
+struct mm_arena {
+   void *chunks;               /* newest first, linked through first word */
+   void *last;                 /* oldest chunk */
+   int nr_chunk;
+   char *cur, *end;            /* unused tail of the newest chunk */
+   void *free[SLAB_MAX_CACHE]; /* freed objects by cache id */
+};
+
 /*
  *  Memory region struct
  */
 struct vm_rg_struct {
-   unsigned long rg_start;
-   unsigned long rg_end;
+   addr_t rg_start;
+   addr_t rg_end;
+   int vmaid; /* area the region was allocated from */
+   int shmid; /* shared memory segment attached here, -1 if private */
 
    struct vm_rg_struct *rg_next;
 };
 
+/*
+ *  Free hole of a vm area, indexed by address and by size
+ */
+#define VM_FREERG_NBINS 32
+
+struct vm_freerg_struct {
+   addr_t rg_start;
+   addr_t rg_end;
+
+   struct avl_node addr_node;
+   struct avl_node size_node;
+   addr_t max_hole; /* largest hole in addr_node subtree */
+};
+
+struct vm_freerg_index {
+   struct mm_arena *arena;  /* hole nodes come from here */
+   struct avl_node *addr_root;
+   struct avl_node *bins[VM_FREERG_NBINS];
+   unsigned long binmap; /* non-empty bins */
+   int nr;
+};
+
+/*
+ *  Symbol region table, region ID -> region
+ */
+struct vm_symtbl {
+   struct vm_rg_struct *rg; /* live regions, dense */
+   int *rgid;               /* region ID of rg[i] */
+   int nr;
+   int cap;
+   int *slot;               /* hash slot -> index in rg[], -1 if empty */
+   int nslot;
+};
+
 /*
  *  Memory area struct
  */
 struct vm_area_struct {
    unsigned long vm_id;
-   unsigned long vm_start;
-   unsigned long vm_end;
+   addr_t vm_start;
+   addr_t vm_end;
 
-   unsigned long sbrk;
+   addr_t sbrk;
 /*
  * Derived field
- * unsigned long vm_limit = vm_end - vm_start
+ * addr_t vm_limit = vm_end - vm_start
  */
    struct mm_struct *vm_mm;
-   struct vm_rg_struct *vm_freerg_list;
+   struct vm_freerg_index vm_freerg;
    struct vm_area_struct *vm_next;
+
+   /* Interval tree of the mm's areas, keyed by vm_start */
+   struct avl_node vm_itnode;
+   addr_t vm_maxend; /* largest vm_end in vm_itnode subtree */
+};
+
+/*
+ * Locking
+ *  mm_struct.lock    page table, areas, regions, FIFO and arena of one
+ *                    process. The owner holds it for every alloc, free,
+ *                    read and write, and for its teardown.
+ *  memphy_pcp.lock   one per-CPU free frame cache.
+ *  memphy.lock       free and used frame lists, frame table links and
+ *                    the swap slot map of a device. The victim FIFO of
+ *                    an mm changes under it with the mm held as well.
+ *  shm segment lock  page states, frame reference counts and the
+ *                    attachment list (reverse map) of one shared memory
+ *                    segment.
+ *  ksm lock          merged frames, their reference counts and the
+ *                    hash chains of the merge scanner.
+ *  zswap pool lock   compressed swap cache.
+ *
+ * Order: mm -> shm -> ksm -> memphy_pcp -> memphy -> zswap. The page of
+ * another process is only ever reached through a device list (used
+ * frames, swap slot age list), so its mm is taken with trylock while the
+ * device lock is still held and a busy mm is skipped (mm_claim).
+ * Holding it pins both the page and the mm: teardown needs the same lock
+ * and empties the device lists before the mm is freed. A frame being
+ * evicted is off every list while its owner is claimed, which is what
+ * stops anyone else reaching it.
+ * A shared frame has no owner: its segment is taken with trylock from
+ * the used list (shm_claim), then every attached mm is claimed from the
+ * reverse map before any of their PTEs change, or the frame stays.
+ * The merge scanner claims the owner of each frame it hashes from the
+ * used list the same way, and the owner of a matching page under the
+ * ksm lock. Load control claims the mm of a process it deactivates
+ * under the scheduler's queue lock, with trylock too.
+ */
+
+/*
+ *  Paging geometry, derived once from the page size, the bus width and
+ *  the MEMRAM size before any device is set up (paging_setup)
+ */
+struct paging_geom {
+   int pagesz;
+   int page_shift;
+   addr_t offst_mask;       /* offset bits of an address */
+   addr_t pgn_mask;         /* page number bits of an address */
+   int bus_width;
+   int max_pgn;
+   pte_t pte_fpn_mask;      /* FPN field of an online PTE */
+};
+
+/*
+ *  Memory limits of a process, or of a group of processes sharing them
+ *  (mm-memcg.c). Private pages of the members are charged, online and
+ *  in swap; segment pages and merged copy-on-write pages are not.
+ */
+#define MEMCG_RSS 0 /* resident frames */
+#define MEMCG_SWP 1 /* swap slots and swap cache entries */
+#define MEMCG_NR  2
+
+struct mm_memcg {
+   int id;                  /* group of the config, -pid of a single process */
+   int max[MEMCG_NR];       /* 0: no limit */
+   int usage[MEMCG_NR];     /* updated atomically, members run apart */
+   int peak[MEMCG_NR];
+   int nr_proc;
+   unsigned long reclaims;  /* pages evicted at the resident limit */
+   unsigned long failures;  /* charges refused, no page to evict */
+   struct mm_memcg *next;
+};
+
+/*
+ *  Fault and working set counts of a process per load control window of
+ *  time slots (mm-loadctl.c), kept by the owner under its mm lock
+ */
+struct mm_wstat {
+   unsigned int win;        /* window the current counts are for */
+   int faults;              /* frames taken on its faults in the window */
+   int wss;                 /* distinct pages it touched in the window */
+   int last_faults;         /* of the last window it ran in, read by */
+   int last_wss;            /* the load control daemon */
+   int peak_faults, peak_wss;
+   unsigned long nr_faults;
 };
 
 /* 
  * Memory management struct
  */
 struct mm_struct {
-   uint32_t *pgd;
+   pte_t *pgd;
+   pthread_mutex_t lock;
+   struct mm_arena *arena; /* of the owner, holds this mm too */
 
-   struct vm_area_struct *mmap;
+   struct vm_area_struct *mmap; /* areas ordered by id */
+   struct vm_area_struct *vmatbl[PAGING_MAX_VMA]; /* areas indexed by id */
+   struct avl_node *vma_itree;
 
-   /* Currently we support a fixed number of symbol */
-   struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
+   /* Allocated regions by region ID */
+   struct vm_symtbl symrgtbl;
 
-   /* list of free page */
-   struct pgn_t *fifo_pgn;
+   /* Private pages in MEMRAM in the order they were mapped, threaded
+    * through the frame table by MEMPHY_put_usedfp, oldest at the head */
+   struct framephy_struct *fifo_head;
+   struct framephy_struct *fifo_tail;
+
+   int oom_killed; /* reaped by the OOM killer, every access fails */
+
+   struct mm_memcg *memcg;     /* limits, NULL if none */
+   int memcg_usage[MEMCG_NR];  /* pages charged by this mm */
+
+   struct mm_wstat wstat;
+};
+
+/*
+ *  Attachment of a shared memory segment to an mm, one node of the
+ *  segment's reverse map (mm-shm.c), carved from the attaching mm's arena
+ */
+struct shm_attach {
+   struct mm_struct *mm;
+   int pgn;                 /* page the segment starts at */
+   struct shm_attach *next;
 };
 
 /*
  * FRAME/MEM PHY struct
+ * One entry per FPN in memphy_struct.frmtbl, the list links are
+ * intrusive: a frame sits on the free list, on the used list, or on a
+ * caller's private list while it is being mapped.
  */
+#define FRAME_FREE   0x1  /* on free_fp_list or in a per-CPU cache */
+#define FRAME_USED   0x2  /* mapped, on used_fp_list */
+#define FRAME_RA     0x4  /* swapped in by readahead, not touched yet */
+#define FRAME_SHM    0x8  /* page of a shared memory segment, no owner,
+                           * pgn holds its SHM_OFF */
+#define FRAME_KSM    0x10 /* merged page mapped copy-on-write, off every
+                           * list and never evicted */
+
 struct framephy_struct { 
    int fpn;
    struct framephy_struct *fp_next;
+   struct framephy_struct *fp_prev;
 
    /* Resereed for tracking allocated framed */
    struct mm_struct* owner;
+   int pgn;
+   struct framephy_struct *fifo_next; /* FIFO of the owner, private frames */
+   struct framephy_struct *fifo_prev;
+   int flags;
+   int refcount; /* PTEs mapping a FRAME_SHM or FRAME_KSM frame */
+   int ksm_seq;  /* merge scan pass that visited the frame, reset when it
+                  * leaves the used list */
+   unsigned int ws_win; /* load control window it was last touched in */
+
+   /* Swap copy still valid while the page is clean, swpoff -1: none */
+   int swptyp;
+   int swpoff;
 };
 
 typedef struct {
@@ -76,19 +288,80 @@ typedef struct {
    int last_used;    // Timestamp to implement LRU
 } TLBEntry;
 
+/*
+ * Per-CPU cache of free frames, sits in front of the device free list.
+ * Frames move a batch at a time, a cache holds two batches at most.
+ */
+#define MEMPHY_PCP_BATCH 8
+#define MEMPHY_PCP_HIGH (2 * MEMPHY_PCP_BATCH)
+
+struct memphy_pcp {
+   pthread_mutex_t lock;
+   int count;
+   int fpn[MEMPHY_PCP_HIGH];
+};
+
 struct memphy_struct {
    /* Basic field of data and size */
    BYTE *storage;
    TLBEntry *entries;
    int maxsz;
+   int filemap; /* storage mapped from a host file */
+   int filefd;  /* host file kept with its state after exit, -1: none */
    
    /* Sequential device fields */ 
    int rdmflg;
    int cursor;
+   unsigned long csr_steps; /* cursor moves, cost of serial access */
+
+   /* Simulated latency of one frame transfer, and the total charged */
+   int lat;
+   unsigned long io_cost;
 
    /* Management structure */
+   struct framephy_struct *frmtbl; /* frame table indexed by FPN */
+   int maxfpn;
    struct framephy_struct *free_fp_list;
-   struct framephy_struct *used_fp_list;
+   int nr_free; /* frames on free_fp_list or never handed out */
+   int fresh_fpn; /* frames from here up were never handed out, their
+                   * frame table entries are implicitly free */
+   struct framephy_struct *used_fp_list; /* oldest first */
+   struct framephy_struct *used_fp_tail;
+
+   /* Device lock, guards free_fp_list and used_fp_list */
+   pthread_mutex_t lock;
+
+   /* Per-CPU free frame caches (NULL if disabled) */
+   struct memphy_pcp *pcp;
+   int npcp;
+   int pcp_batch;
+
+   /* Swap slot map, built on first use as swap space (mm-swap.c) */
+   unsigned long *swp_map;  /* bit set: slot in use */
+   unsigned short *swp_cnt; /* references per slot */
+   struct mm_struct **swp_owner; /* page held by a slot, NULL if shared */
+   int *swp_pgn;
+   int *swp_lnext, *swp_lprev; /* age list of slots in use */
+   int swp_lhead, swp_ltail;
+   int swp_nr;
+   int swp_free;
+   int swp_hint;            /* map word to scan first */
+};
+
+/*
+ *  Background reclaim daemon of a MEMRAM device (mm-kswapd.c)
+ */
+#define KSWAPD_BATCH 4 /* evictions per time slot */
+
+struct kswapd_struct {
+   struct memphy_struct *mram;
+   struct pcb_t *ctx;            /* devices to reclaim to, no mm */
+   struct timer_id_t *timer_id;
+   int low, high;                /* free frame watermarks */
+   int stop;                     /* read and set atomically */
+   pthread_t thread;
+
+   unsigned long wakeups, reclaimed;
 };
 
 #endif
@@ -23,6 +23,12 @@ void put_proc(struct pcb_t * proc);
 /* Add a new process to ready queue */
 void add_proc(struct pcb_t * proc);
 
+/* Load control: take the lowest priority ready process out of the
+ * queues, and put the first one taken out back, each if [admit] agrees.
+ * [admit] runs under the queue lock */
+struct pcb_t * deactivate_proc(int (*admit)(struct pcb_t * proc));
+struct pcb_t * reactivate_proc(int (*admit)(struct pcb_t * proc));
+
 #endif
 
 
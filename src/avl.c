@@ -0,0 +1,161 @@
+/*
+ * PAGING based Memory Management
+ * Intrusive AVL tree mm/avl.c
+ *
+ * Height balanced tree of nodes embedded in the indexed structs, used
+ * by the free region index and the VMA interval tree. Insert and erase
+ * are O(log n); the optional update callback refreshes augmented data
+ * on the way back up.
+ */
+
+#include "avl.h"
+
+static int avl_height(struct avl_node *node)
+{
+   return node ? node->avl_height : 0;
+}
+
+static struct avl_node *avl_fix(struct avl_node *node, avl_update_t update)
+{
+   int hl = avl_height(node->avl_left);
+   int hr = avl_height(node->avl_right);
+
+   node->avl_height = 1 + (hl > hr ? hl : hr);
+   if (update)
+     update(node);
+   return node;
+}
+
+static struct avl_node *avl_rotate_right(struct avl_node *node, avl_update_t update)
+{
+   struct avl_node *l = node->avl_left;
+
+   node->avl_left = l->avl_right;
+   l->avl_right = node;
+   avl_fix(node, update);
+   return avl_fix(l, update);
+}
+
+static struct avl_node *avl_rotate_left(struct avl_node *node, avl_update_t update)
+{
+   struct avl_node *r = node->avl_right;
+
+   node->avl_right = r->avl_left;
+   r->avl_left = node;
+   avl_fix(node, update);
+   return avl_fix(r, update);
+}
+
+static struct avl_node *avl_balance(struct avl_node *node, avl_update_t update)
+{
+   int bf;
+
+   avl_fix(node, update);
+   bf = avl_height(node->avl_left) - avl_height(node->avl_right);
+   if (bf > 1)
+   {
+     if (avl_height(node->avl_left->avl_left) <
+         avl_height(node->avl_left->avl_right))
+       node->avl_left = avl_rotate_left(node->avl_left, update);
+     return avl_rotate_right(node, update);
+   }
+   if (bf < -1)
+   {
+     if (avl_height(node->avl_right->avl_right) <
+         avl_height(node->avl_right->avl_left))
+       node->avl_right = avl_rotate_right(node->avl_right, update);
+     return avl_rotate_left(node, update);
+   }
+   return node;
+}
+
+static struct avl_node *avl_insert_at(struct avl_node *at, struct avl_node *node,
+                                      avl_cmp_t cmp, avl_update_t update)
+{
+   if (at == NULL)
+   {
+     node->avl_left = node->avl_right = NULL;
+     return avl_fix(node, update);
+   }
+   if (cmp(node, at) < 0)
+     at->avl_left = avl_insert_at(at->avl_left, node, cmp, update);
+   else
+     at->avl_right = avl_insert_at(at->avl_right, node, cmp, update);
+   return avl_balance(at, update);
+}
+
+static struct avl_node *avl_remove_min(struct avl_node *at, struct avl_node **min,
+                                       avl_update_t update)
+{
+   if (at->avl_left == NULL)
+   {
+     *min = at;
+     return at->avl_right;
+   }
+   at->avl_left = avl_remove_min(at->avl_left, min, update);
+   return avl_balance(at, update);
+}
+
+static struct avl_node *avl_erase_at(struct avl_node *at, struct avl_node *node,
+                                     avl_cmp_t cmp, avl_update_t update)
+{
+   struct avl_node *min;
+   int c;
+
+   if (at == NULL)
+     return NULL;
+   c = (at == node) ? 0 : cmp(node, at);
+   if (c < 0)
+     at->avl_left = avl_erase_at(at->avl_left, node, cmp, update);
+   else if (c > 0)
+     at->avl_right = avl_erase_at(at->avl_right, node, cmp, update);
+   else {
+     if (at->avl_left == NULL)
+       return at->avl_right;
+     if (at->avl_right == NULL)
+       return at->avl_left;
+     /* Replace by the in-order successor */
+     at->avl_right = avl_remove_min(at->avl_right, &min, update);
+     min->avl_left = at->avl_left;
+     min->avl_right = at->avl_right;
+     at = min;
+   }
+   return avl_balance(at, update);
+}
+
+/*
+ *  avl_insert - add a node, keys compared by cmp must be unique among
+ *  the tree nodes
+ */
+void avl_insert(struct avl_node **root, struct avl_node *node,
+                avl_cmp_t cmp, avl_update_t update)
+{
+   *root = avl_insert_at(*root, node, cmp, update);
+}
+
+/*
+ *  avl_erase - take a node out of the tree
+ */
+void avl_erase(struct avl_node **root, struct avl_node *node,
+               avl_cmp_t cmp, avl_update_t update)
+{
+   *root = avl_erase_at(*root, node, cmp, update);
+}
+
+struct avl_node *avl_first(struct avl_node *root)
+{
+   if (root == NULL)
+     return NULL;
+   while (root->avl_left)
+     root = root->avl_left;
+   return root;
+}
+
+struct avl_node *avl_last(struct avl_node *root)
+{
+   if (root == NULL)
+     return NULL;
+   while (root->avl_right)
+     root = root->avl_right;
+   return root;
+}
@@ -15,6 +15,7 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 
 int tlb_change_all_page_tables_of(struct pcb_t *proc,  struct memphy_struct * mp)
 {
@@ -28,23 +29,22 @@ int tlb_change_all_page_tables_of(struct pcb_t *proc,  struct memphy_struct * mp
 
 int tlb_flush_tlb_of(struct pcb_t *proc, struct memphy_struct * mp)
 {
-  /* TODO flush tlb cached*/
-  if (proc == NULL || mp == NULL || mp->used_fp_list == NULL) {
+  if (proc == NULL || mp == NULL || mp->entries == NULL) {
       // Return an error code to indicate invalid input parameters
       return -1;
   }
-  struct framephy_struct *tlb_cache = mp->used_fp_list;
-
-  // Iterate through the TLB cache
-  while (tlb_cache != NULL) {
-      // Check if the TLB entry is associated with the provided process (proc)
-      if (tlb_cache->owner == proc->mm) {
-          // Invalidate the TLB entry by setting its owner to NULL
-          MEMPHY_remove_usedfp(mp, tlb_cache->fpn);
-          MEMPHY_put_freefp(mp, tlb_cache->fpn);
+
+  // Invalidate every cache line tagged with the process's pid
+  pthread_mutex_lock(&mp->lock);
+  for (int i = 0; i < mp->maxsz / sizeof(TLBEntry); i++) {
+      if (mp->entries[i].valid && mp->entries[i].pid == proc->pid) {
+          mp->entries[i].valid = 0;
+          mp->entries[i].pid = -1;
+          mp->entries[i].page_number = -1;
+          mp->entries[i].frame_number = -1;
       }
-      tlb_cache = tlb_cache->fp_next;
   }
+  pthread_mutex_unlock(&mp->lock);
 
   return 0;
 }
@@ -53,12 +53,13 @@ int tlb_flush_tlb_of(struct pcb_t *proc, struct memphy_struct * mp)
  *@proc:  Process executing the instruction
  *@size: allocated size 
  *@reg_index: memory region ID (used to identify variable in symbole table)
+ *@vmaid: ID vm area to alloc memory region
  */
-int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
+int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index, uint32_t vmaid)
 {
-  int addr, val;
-  /* By default using vmaid = 0 */
-  val = __alloc(proc, 0, reg_index, size, &addr);
+  addr_t addr;
+  int val;
+  val = __alloc(proc, vmaid, reg_index, size, &addr);
 
   /* TODO update TLB CACHED frame num of the new allocated page(s)*/
   /* by using tlb_cache_read()/tlb_cache_write()*/
@@ -76,7 +77,8 @@ int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
       tlb_cache_write(tlb, pid, pgnum, new_frame_number);
 
       // Print status
-      printf("Memory allocated successfully for Process %d - size: %u, address: %d\n", proc->pid, size, addr);
+      printf("Memory allocated successfully for Process %d - size: %u, address: %lu\n",
+             proc->pid, size, (unsigned long)addr);
   } else {
       // Print error if memory allocation fails
       printf("Memory allocation failed for Process %d - size: %u\n", proc->pid, size);
@@ -92,7 +94,7 @@ int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
  */
 int tlbfree_data(struct pcb_t *proc, uint32_t reg_index)
 {
-  __free(proc, 0, reg_index);
+  __free(proc, get_symrg_vmaid(proc->mm, reg_index), reg_index);
 
   /* TODO update TLB CACHED frame num of freed page(s)*/
   /* by using tlb_cache_read()/tlb_cache_write()*/
@@ -132,7 +134,7 @@ int tlbread(struct pcb_t * proc, uint32_t source,
   /* frmnum is return value of tlb_cache_read/write value*/
   
 	frmnum = tlb_cache_read(proc->tlb, proc->pid, source, &data);
-  int val = __read(proc, 0, source, offset, &data);
+  int val = __read(proc, get_symrg_vmaid(proc->mm, source), source, offset, &data);
 #ifdef IODUMP
   if (frmnum >= 0)
     printf("TLB hit at read region=%d offset=%d\n", 
@@ -141,15 +143,16 @@ int tlbread(struct pcb_t * proc, uint32_t source,
     printf("TLB miss at read region=%d offset=%d\n", 
 	         source, offset);
 #ifdef PAGETBL_DUMP
+  pthread_mutex_lock(&proc->mm->lock);
   print_pgtbl(proc, 0, -1); //print max TBL
+  pthread_mutex_unlock(&proc->mm->lock);
 #endif
   MEMPHY_dump(proc->mram);
 #endif
 
+  /* A miss refills the line, the LRU one is replaced when the cache is full */
   if(frmnum < 0){
-    if(tlb_cache_write(proc->tlb, proc->pid, source, destination) < 0){
-      tlb_flush_tlb_of(proc, proc->tlb);
-    }
+    tlb_cache_write(proc->tlb, proc->pid, source, destination);
   }
 
   destination = (uint32_t) data;
@@ -175,7 +178,7 @@ int tlbwrite(struct pcb_t * proc, BYTE data,
   /* by using tlb_cache_read()/tlb_cache_write()
   frmnum is return value of tlb_cache_read/write value*/
   frmnum = tlb_cache_write(proc->tlb, proc->pid, destination, data);
-  val = __write(proc, 0, destination, offset, data);
+  val = __write(proc, get_symrg_vmaid(proc->mm, destination), destination, offset, data);
 #ifdef IODUMP
   if (frmnum >= 0)
     printf("TLB hit at write region=%d offset=%d value=%d\n",
@@ -184,14 +187,14 @@ int tlbwrite(struct pcb_t * proc, BYTE data,
     printf("TLB miss at write region=%d offset=%d value=%d\n",
             destination, offset, data);
 #ifdef PAGETBL_DUMP
+  pthread_mutex_lock(&proc->mm->lock);
   print_pgtbl(proc, 0, -1); //print max TBL
+  pthread_mutex_unlock(&proc->mm->lock);
 #endif
   MEMPHY_dump(proc->mram);
 #endif
    if(frmnum < 0){
-    if(tlb_cache_write(proc->tlb, proc->pid, destination, data) < 0){
-      tlb_flush_tlb_of(proc, proc->tlb);
-    }
+    tlb_cache_write(proc->tlb, proc->pid, destination, data);
   }
 
 
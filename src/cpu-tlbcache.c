@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #ifdef CPU_TLB
 
 
@@ -28,13 +29,11 @@
 int global_timer = 0;
 
 /*
- *  tlb_cache_read read TLB cache device
- *  @mp: memphy struct
- *  @pid: process id
- *  @pgnum: page number
- *  @value: obtained value
+ *  __tlb_cache_lookup - find the line of a page, caller holds mp->lock
+ *  The cache is shared by every CPU thread, mp->lock guards the lines
+ *  and global_timer.
  */
-int tlb_cache_read(struct memphy_struct * mp, int pid, int pgnum, BYTE *value)
+static int __tlb_cache_lookup(struct memphy_struct * mp, int pid, int pgnum, BYTE *value)
 {
    /* TODO: the identify info is mapped to 
     *      cache line by employing:
@@ -50,6 +49,24 @@ int tlb_cache_read(struct memphy_struct * mp, int pid, int pgnum, BYTE *value)
     return -1;  // TLB miss
 }
 
+/*
+ *  tlb_cache_read read TLB cache device
+ *  @mp: memphy struct
+ *  @pid: process id
+ *  @pgnum: page number
+ *  @value: obtained value
+ */
+int tlb_cache_read(struct memphy_struct * mp, int pid, int pgnum, BYTE *value)
+{
+   int ret;
+
+   pthread_mutex_lock(&mp->lock);
+   ret = __tlb_cache_lookup(mp, pid, pgnum, value);
+   pthread_mutex_unlock(&mp->lock);
+
+   return ret;
+}
+
 /*
  *  tlb_cache_write write TLB cache device
  *  @mp: memphy struct
@@ -67,10 +84,15 @@ int tlb_cache_write(struct memphy_struct *mp, int pid, int pgnum, BYTE value)
    int min_used_time = INT_MAX;
    BYTE data;
 
-   if ( tlb_cache_read(mp, pid, pgnum, &data) == 0) return 0; // HIT
+   pthread_mutex_lock(&mp->lock);
+   if ( __tlb_cache_lookup(mp, pid, pgnum, &data) == 0) {
+        pthread_mutex_unlock(&mp->lock);
+        return 0; // HIT
+   }
    for (int i = 0; i < mp->maxsz / sizeof(TLBEntry); i++) {
         if (!mp->entries[i].valid) {  // Find an empty slot
             mp->entries[i] = (TLBEntry){1, pid, pgnum, value, ++global_timer};
+            pthread_mutex_unlock(&mp->lock);
             return 0;  // New entry added
         }
         if (mp->entries[i].last_used < min_used_time) {  // Track least recently used
@@ -81,6 +103,7 @@ int tlb_cache_write(struct memphy_struct *mp, int pid, int pgnum, BYTE value)
     
    // No empty slot found, replace least recently used
    mp->entries[min_used_index] = (TLBEntry){1, pid, pgnum, value, ++global_timer};
+   pthread_mutex_unlock(&mp->lock);
    return -1; // MISS
 }
 
@@ -149,6 +172,11 @@ int init_tlbmemphy(struct memphy_struct *mp, int max_size)
    mp->maxsz = max_size;
    mp->rdmflg = 1;
    mp->entries = (TLBEntry *)mp->storage;
+   mp->free_fp_list = NULL;
+   mp->used_fp_list = NULL;
+   pthread_mutex_init(&mp->lock, NULL);
+   mp->pcp = NULL;
+   mp->npcp = 0;
    
    for (int i = 0; i < mp->maxsz / sizeof(TLBEntry); i++) {
       mp->entries[i].valid = 0;
@@ -60,9 +60,9 @@ int run(struct pcb_t * proc) {
 		break;
 	case ALLOC:
 #ifdef CPU_TLB 
-		stat = tlballoc(proc, ins.arg_0, ins.arg_1);
+		stat = tlballoc(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #elif defined(MM_PAGING)
-		stat = pgalloc(proc, ins.arg_0, ins.arg_1);
+		stat = pgalloc(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #else
 		stat = alloc(proc, ins.arg_0, ins.arg_1);
 #endif
@@ -94,6 +94,17 @@ int run(struct pcb_t * proc) {
 		stat = write(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #endif
 		break;
+#ifdef MM_PAGING
+	case SHMGET:
+		stat = pgshmget(proc, ins.arg_0, ins.arg_1);
+		break;
+	case SHMAT:
+		stat = pgshmat(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+		break;
+	case SHMDT:
+		stat = pgshmdt(proc, ins.arg_0);
+		break;
+#endif
 	default:
 		stat = 1;
 	}
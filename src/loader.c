@@ -11,6 +11,9 @@ static uint32_t avail_pid = 1;
 #define OPT_FREE	"free"
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
+#define OPT_SHMGET	"shmget"
+#define OPT_SHMAT	"shmat"
+#define OPT_SHMDT	"shmdt"
 
 static enum ins_opcode_t get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
@@ -23,6 +26,12 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return READ;
 	}else if (!strcmp(opt, OPT_WRITE)) {
 		return WRITE;
+	}else if (!strcmp(opt, OPT_SHMGET)) {
+		return SHMGET;
+	}else if (!strcmp(opt, OPT_SHMAT)) {
+		return SHMAT;
+	}else if (!strcmp(opt, OPT_SHMDT)) {
+		return SHMDT;
 	}else{
 		printf("Opcode: %s\n", opt);
 		exit(1);
@@ -46,8 +55,13 @@ struct pcb_t * load(const char * path) {
 		exit(1);		
 	}
 	char opcode[10];
+	char line[100];
 	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
+	if (fscanf(file, "%u %u", &proc->priority, &proc->code->size) != 2) {
+		/* Unreadable description, run it as an empty process */
+		proc->priority = 0;
+		proc->code->size = 0;
+	}
 	proc->code->text = (struct inst_t*)malloc(
 		sizeof(struct inst_t) * proc->code->size
 	);
@@ -59,12 +73,17 @@ struct pcb_t * load(const char * path) {
 		case CALC:
 			break;
 		case ALLOC:
-			fscanf(
-				file,
-				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
-			);
+			/* alloc [size] [region] [vm area, optional] */
+			proc->code->text[i].arg_2 = 0;
+			if (fgets(line, sizeof(line), file) != NULL) {
+				sscanf(
+					line,
+					"%u %u %u",
+					&proc->code->text[i].arg_0,
+					&proc->code->text[i].arg_1,
+					&proc->code->text[i].arg_2
+				);
+			}
 			break;
 		case FREE:
 			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
@@ -79,6 +98,31 @@ struct pcb_t * load(const char * path) {
 				&proc->code->text[i].arg_2
 			);
 			break;	
+		case SHMGET:
+			/* shmget [key] [size] */
+			fscanf(
+				file,
+				"%u %u\n",
+				&proc->code->text[i].arg_0,
+				&proc->code->text[i].arg_1
+			);
+			break;
+		case SHMAT:
+			/* shmat [key] [region] [vm area, optional] */
+			proc->code->text[i].arg_2 = 0;
+			if (fgets(line, sizeof(line), file) != NULL) {
+				sscanf(
+					line,
+					"%u %u %u",
+					&proc->code->text[i].arg_0,
+					&proc->code->text[i].arg_1,
+					&proc->code->text[i].arg_2
+				);
+			}
+			break;
+		case SHMDT:
+			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
+			break;
 		default:
 			printf("Opcode: %s\n", opcode);
 			exit(1);
@@ -87,5 +131,13 @@ struct pcb_t * load(const char * path) {
 	return proc;
 }
 
+void unload(struct pcb_t * proc) {
+	/* Release what load() allocated, memory is handled by the caller */
+	free(proc->code->text);
+	free(proc->code);
+	free(proc->page_table);
+	free(proc);
+}
+
 
 
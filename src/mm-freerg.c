@@ -0,0 +1,283 @@
+/*
+ * PAGING based Memory Management
+ * Free region index mm/mm-freerg.c
+ *
+ * Free holes of a vm area are kept in two intrusive AVL trees at once:
+ *  - an address ordered tree, augmented with the largest hole of every
+ *    subtree, used for coalescing on free and for first-fit descent
+ *  - size-segregated bins (one per power of two), each a tree ordered
+ *    by (size, address), used for best-fit lookup
+ * Both fits and both update paths are O(log n).
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define FREERG_SIZE(rg) ((rg)->rg_end - (rg)->rg_start)
+#define ADDR_ENTRY(n) avl_entry(n, struct vm_freerg_struct, addr_node)
+#define SIZE_ENTRY(n) avl_entry(n, struct vm_freerg_struct, size_node)
+
+static int freerg_addr_cmp(const struct avl_node *a, const struct avl_node *b)
+{
+  addr_t sa = ADDR_ENTRY(a)->rg_start, sb = ADDR_ENTRY(b)->rg_start;
+
+  return (sa < sb) ? -1 : (sa > sb);
+}
+
+static void freerg_addr_update(struct avl_node *n)
+{
+  struct vm_freerg_struct *rg = ADDR_ENTRY(n);
+
+  rg->max_hole = FREERG_SIZE(rg);
+  if (n->avl_left && ADDR_ENTRY(n->avl_left)->max_hole > rg->max_hole)
+    rg->max_hole = ADDR_ENTRY(n->avl_left)->max_hole;
+  if (n->avl_right && ADDR_ENTRY(n->avl_right)->max_hole > rg->max_hole)
+    rg->max_hole = ADDR_ENTRY(n->avl_right)->max_hole;
+}
+
+static int freerg_size_cmp(const struct avl_node *a, const struct avl_node *b)
+{
+  struct vm_freerg_struct *ra = SIZE_ENTRY(a), *rb = SIZE_ENTRY(b);
+
+  if (FREERG_SIZE(ra) != FREERG_SIZE(rb))
+    return (FREERG_SIZE(ra) < FREERG_SIZE(rb)) ? -1 : 1;
+  return (ra->rg_start < rb->rg_start) ? -1 : (ra->rg_start > rb->rg_start);
+}
+
+/* Size class: floor(log2(size)) */
+static int freerg_bin(addr_t size)
+{
+  int bin = 0;
+
+  while (size > 1 && bin < VM_FREERG_NBINS - 1) {
+    size >>= 1;
+    bin++;
+  }
+  return bin;
+}
+
+static void freerg_link(struct vm_freerg_index *idx, struct vm_freerg_struct *rg)
+{
+  int bin = freerg_bin(FREERG_SIZE(rg));
+
+  avl_insert(&idx->addr_root, &rg->addr_node, freerg_addr_cmp, freerg_addr_update);
+  avl_insert(&idx->bins[bin], &rg->size_node, freerg_size_cmp, NULL);
+  idx->binmap |= 1UL << bin;
+  idx->nr++;
+}
+
+static void freerg_unlink(struct vm_freerg_index *idx, struct vm_freerg_struct *rg)
+{
+  int bin = freerg_bin(FREERG_SIZE(rg));
+
+  avl_erase(&idx->addr_root, &rg->addr_node, freerg_addr_cmp, freerg_addr_update);
+  avl_erase(&idx->bins[bin], &rg->size_node, freerg_size_cmp, NULL);
+  if (idx->bins[bin] == NULL)
+    idx->binmap &= ~(1UL << bin);
+  idx->nr--;
+}
+
+/*
+ * freerg_neighbours - holes just below and at/above @start
+ */
+static void freerg_neighbours(struct vm_freerg_index *idx, addr_t start,
+                              struct vm_freerg_struct **pred,
+                              struct vm_freerg_struct **succ)
+{
+  struct avl_node *n = idx->addr_root;
+
+  *pred = *succ = NULL;
+  while (n != NULL) {
+    if (ADDR_ENTRY(n)->rg_start < start) {
+      *pred = ADDR_ENTRY(n);
+      n = n->avl_right;
+    } else {
+      *succ = ADDR_ENTRY(n);
+      n = n->avl_left;
+    }
+  }
+}
+
+/*
+ * freerg_first_fit - lowest addressed hole of at least @size
+ */
+static struct vm_freerg_struct *freerg_first_fit(struct vm_freerg_index *idx,
+                                                 addr_t size)
+{
+  struct avl_node *n = idx->addr_root;
+
+  if (n == NULL || ADDR_ENTRY(n)->max_hole < size)
+    return NULL;
+
+  while (n != NULL) {
+    if (n->avl_left && ADDR_ENTRY(n->avl_left)->max_hole >= size)
+      n = n->avl_left;
+    else if (FREERG_SIZE(ADDR_ENTRY(n)) >= size)
+      return ADDR_ENTRY(n);
+    else
+      n = n->avl_right;
+  }
+  return NULL;
+}
+
+/*
+ * freerg_best_fit - smallest hole of at least @size, lowest address on ties
+ */
+static struct vm_freerg_struct *freerg_best_fit(struct vm_freerg_index *idx,
+                                                addr_t size)
+{
+  int bin;
+
+  for (bin = freerg_bin(size); bin < VM_FREERG_NBINS; bin++) {
+    struct avl_node *n, *best = NULL;
+
+    if (!(idx->binmap & (1UL << bin)))
+      continue;
+
+    /* Lower bound of size in this bin */
+    n = idx->bins[bin];
+    while (n != NULL) {
+      if (FREERG_SIZE(SIZE_ENTRY(n)) >= size) {
+        best = n;
+        n = n->avl_left;
+      } else {
+        n = n->avl_right;
+      }
+    }
+    if (best != NULL)
+      return SIZE_ENTRY(best);
+  }
+  return NULL;
+}
+
+void vm_freerg_init(struct vm_freerg_index *idx, struct mm_arena *arena)
+{
+  int bin;
+
+  idx->arena = arena;
+  idx->addr_root = NULL;
+  for (bin = 0; bin < VM_FREERG_NBINS; bin++)
+    idx->bins[bin] = NULL;
+  idx->binmap = 0;
+  idx->nr = 0;
+}
+
+/*
+ * vm_freerg_insert - give [start, end) back, merging with adjacent holes
+ * Return -1 on an empty range, one overlapping an existing hole or when
+ * no node can be had for it.
+ */
+int vm_freerg_insert(struct vm_freerg_index *idx, addr_t start, addr_t end)
+{
+  struct vm_freerg_struct *pred, *succ, *rg;
+
+  if (start >= end)
+    return -1;
+
+  freerg_neighbours(idx, start, &pred, &succ);
+  if ((pred && pred->rg_end > start) || (succ && succ->rg_start < end))
+    return -1; /* Double free */
+
+  /* A hole the range touches is reused, a new node only for a lone one */
+  if (pred && pred->rg_end == start) {
+    freerg_unlink(idx, pred);
+    start = pred->rg_start;
+    rg = pred;
+    if (succ && succ->rg_start == end) {
+      freerg_unlink(idx, succ);
+      end = succ->rg_end;
+      mm_arena_free(idx->arena, &freerg_cache, succ);
+    }
+  } else if (succ && succ->rg_start == end) {
+    freerg_unlink(idx, succ);
+    end = succ->rg_end;
+    rg = succ;
+  } else if ((rg = mm_arena_alloc(idx->arena, &freerg_cache)) == NULL) {
+    return -1;
+  }
+
+  rg->rg_start = start;
+  rg->rg_end = end;
+  freerg_link(idx, rg);
+
+  return 0;
+}
+
+/*
+ * vm_freerg_alloc - carve @size bytes from the front of a fitting hole
+ * @fit: VMRG_FIRSTFIT or VMRG_BESTFIT
+ */
+int vm_freerg_alloc(struct vm_freerg_index *idx, addr_t size, int fit,
+                    struct vm_rg_struct *newrg)
+{
+  struct vm_freerg_struct *rg;
+
+  if (size == 0)
+    return -1;
+
+  if (fit == VMRG_BESTFIT)
+    rg = freerg_best_fit(idx, size);
+  else
+    rg = freerg_first_fit(idx, size);
+
+  if (rg == NULL)
+    return -1;
+
+  newrg->rg_start = rg->rg_start;
+  newrg->rg_end = rg->rg_start + size;
+
+  freerg_unlink(idx, rg);
+  if (FREERG_SIZE(rg) > size) {
+    rg->rg_start += size;
+    freerg_link(idx, rg);
+  } else {
+    mm_arena_free(idx->arena, &freerg_cache, rg);
+  }
+
+  return 0;
+}
+
+/*
+ * vm_freerg_last - highest addressed hole
+ */
+struct vm_freerg_struct *vm_freerg_last(struct vm_freerg_index *idx)
+{
+  struct avl_node *n = avl_last(idx->addr_root);
+
+  return n ? ADDR_ENTRY(n) : NULL;
+}
+
+/*
+ * vm_freerg_find - hole containing @addr
+ */
+struct vm_freerg_struct *vm_freerg_find(struct vm_freerg_index *idx, addr_t addr)
+{
+  struct vm_freerg_struct *pred, *succ;
+
+  freerg_neighbours(idx, addr + 1, &pred, &succ);
+  if (pred != NULL && addr < pred->rg_end)
+    return pred;
+
+  return NULL;
+}
+
+static void print_freerg(struct avl_node *n)
+{
+  if (n == NULL)
+    return;
+  print_freerg(n->avl_left);
+  printf("rg[%lu->%lu]\n", (unsigned long)ADDR_ENTRY(n)->rg_start,
+         (unsigned long)ADDR_ENTRY(n)->rg_end);
+  print_freerg(n->avl_right);
+}
+
+int print_list_freerg(struct vm_freerg_index *idx)
+{
+  printf("print_list_rg: ");
+  if (idx->addr_root == NULL) {printf("NULL list\n"); return -1;}
+  printf("\n");
+  print_freerg(idx->addr_root);
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,428 @@
+/*
+ * PAGING based Memory Management
+ * Same page merging mm/mm-ksm.c
+ *
+ * An optional daemon runs as a timer device and walks the used frames of
+ * MEMRAM, a batch per time slot. A page whose hash did not change since
+ * the previous pass is looked up among the merged frames first, then
+ * among the pages seen earlier in this pass. A page equal byte for byte
+ * is merged: every PTE maps one frame with PAGING_PTE_COW_MASK set and
+ * the other frame is freed. The first write through such a PTE gives
+ * the writer a private copy back (ksm_break_cow).
+ *
+ * A merged frame is off the used list and never evicted, its refcount
+ * counts the PTEs mapping it. Nothing else points at it, so no reverse
+ * map is needed: each mapper drops its reference on write or release.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define KSM_HASHSZ 256
+
+static struct {
+   struct memphy_struct *mram;
+   struct pcb_t *ctx;           /* devices swap copies are dropped from */
+   struct timer_id_t *timer_id;
+   pthread_t thread;
+   int batch;                   /* frames visited per time slot */
+   int stop;
+
+   int seq;                     /* current pass, stamped in ksm_seq */
+   uint32_t *sum;               /* last hash per FPN */
+   int stable[KSM_HASHSZ];      /* merged frames by hash */
+   int *stable_next;
+   int unstable[KSM_HASHSZ];    /* frames visited in this pass by hash */
+   int *unstable_next;
+   int *unstable_seq;           /* pass a frame was chained in */
+
+   unsigned long full_scans, merged, cow_breaks;
+   int pages_shared;            /* merged frames */
+   int pages_sharing;           /* PTEs mapping them beyond the first */
+   int max_sharing;
+   pthread_mutex_t lock;
+
+   BYTE page[PAGING_MAX_PAGESZ];  /* page being scanned, by the daemon only */
+   BYTE cmp[PAGING_MAX_PAGESZ];   /* page it is compared with */
+} ksm = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ *  ksm_hash - hash of a page, four independent lanes over 64-bit words
+ *  so the compiler can keep them in one vector register
+ */
+static uint32_t ksm_hash(const BYTE *page)
+{
+   uint64_t h[4] = { 1, 2, 3, 4 }, w[4], x;
+   int i, l;
+
+   for (i = 0; i < PAGING_PAGESZ; i += sizeof(w))
+   {
+     memcpy(w, page + i, sizeof(w));
+     for (l = 0; l < 4; l++)
+       h[l] = (h[l] ^ w[l]) * 0x100000001b3ULL;
+   }
+
+   x = h[0] ^ (h[1] * 3) ^ (h[2] * 5) ^ (h[3] * 7);
+   return (uint32_t)(x ^ (x >> 32));
+}
+
+/*
+ *  ksm_pte_maps - the page is mapped privately by the frame
+ */
+static int ksm_pte_maps(struct mm_struct *mm, int pgn, int fpn)
+{
+   pte_t pte = mm->pgd[pgn];
+
+   return PAGING_PAGE_PRESENT(pte) && !PAGING_PAGE_SWAPPED(pte) &&
+          !(pte & (PAGING_PTE_SHARED_MASK | PAGING_PTE_COW_MASK)) &&
+          PAGING_PTE_FPN(pte) == fpn;
+}
+
+/*
+ *  ksm_next_frame - claim the owner of the oldest used frame not visited
+ *  in this pass
+ *
+ *  Return NULL once every frame on the used list was visited
+ */
+static struct framephy_struct *ksm_next_frame(struct mm_struct **mm, int *pgn)
+{
+   struct framephy_struct *fp;
+
+   pthread_mutex_lock(&ksm.mram->lock);
+   for (fp = ksm.mram->used_fp_list; fp != NULL; fp = fp->fp_next)
+   {
+     if (fp->ksm_seq == ksm.seq)
+       continue;
+     fp->ksm_seq = ksm.seq;
+     if (!(fp->flags & FRAME_SHM) && mm_claim(fp->owner, NULL) == 0)
+     {
+       *mm = fp->owner;
+       *pgn = fp->pgn;
+       break;
+     }
+   }
+   pthread_mutex_unlock(&ksm.mram->lock);
+
+   return fp;
+}
+
+/*
+ *  ksm_claim_unstable - claim the owner of a frame chained in this pass,
+ *  if the frame stayed on the used list since it was visited
+ */
+static int ksm_claim_unstable(int fpn, struct mm_struct *self,
+                              struct mm_struct **mm, int *pgn)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(ksm.mram, fpn);
+   int ret = -1;
+
+   pthread_mutex_lock(&ksm.mram->lock);
+   /* Leaving the used list resets ksm_seq, so the owner is unchanged */
+   if (fp->ksm_seq == ksm.seq && mm_claim(fp->owner, self) == 0)
+   {
+     *mm = fp->owner;
+     *pgn = fp->pgn;
+     ret = 0;
+   }
+   pthread_mutex_unlock(&ksm.mram->lock);
+
+   return ret;
+}
+
+/*
+ *  ksm_stable_find - merged frame holding a page, caller holds ksm.lock
+ */
+static int ksm_stable_find(const BYTE *page, uint32_t sum)
+{
+   BYTE *kpage = ksm.cmp;
+   int k;
+
+   for (k = ksm.stable[sum % KSM_HASHSZ]; k >= 0; k = ksm.stable_next[k])
+   {
+     if (ksm.sum[k] != sum)
+       continue;
+     MEMPHY_read_block(ksm.mram, k * PAGING_PAGESZ, kpage, PAGING_PAGESZ);
+     if (memcmp(page, kpage, PAGING_PAGESZ) == 0)
+       return k;
+   }
+
+   return -1;
+}
+
+/*
+ *  ksm_stable_remove - unchain a merged frame, caller holds ksm.lock
+ */
+static void ksm_stable_remove(int fpn)
+{
+   int *k;
+
+   for (k = &ksm.stable[ksm.sum[fpn] % KSM_HASHSZ]; *k >= 0; k = &ksm.stable_next[*k])
+     if (*k == fpn)
+     {
+       *k = ksm.stable_next[fpn];
+       break;
+     }
+}
+
+/*
+ *  ksm_unstable_merge - merge a page with an equal one visited earlier in
+ *  this pass, caller holds ksm.lock and the page's mm
+ *  @mm: mm of the page
+ *  @page: content of the page
+ *  @sum: its hash
+ *
+ *  Return the frame both pages are to share, -1 if there is none
+ */
+static int ksm_unstable_merge(struct mm_struct *mm, int fpn, const BYTE *page, uint32_t sum)
+{
+   BYTE *upage = ksm.cmp;
+   struct framephy_struct *up;
+   struct mm_struct *umm;
+   int u, upgn, ret = -1;
+
+   for (u = ksm.unstable[sum % KSM_HASHSZ]; u >= 0 && ret < 0; u = ksm.unstable_next[u])
+   {
+     if (u == fpn || ksm.sum[u] != sum || ksm_claim_unstable(u, mm, &umm, &upgn) < 0)
+       continue;
+
+     MEMPHY_read_block(ksm.mram, u * PAGING_PAGESZ, upage, PAGING_PAGESZ);
+     if (ksm_pte_maps(umm, upgn, u) && memcmp(page, upage, PAGING_PAGESZ) == 0)
+     {
+       /* The frame seen first becomes the merged one */
+       MEMPHY_remove_usedfp(ksm.mram, u);
+       swap_drop_copy(ksm.ctx, u);
+       up = MEMPHY_get_frame(ksm.mram, u);
+       up->flags |= FRAME_KSM;
+       up->refcount = 1;
+       SETBIT(umm->pgd[upgn], PAGING_PTE_COW_MASK);
+       memcg_charge(umm, -1, 0);
+
+       ksm.stable_next[u] = ksm.stable[sum % KSM_HASHSZ];
+       ksm.stable[sum % KSM_HASHSZ] = u;
+       ksm.pages_shared++;
+       ret = u;
+     }
+     mm_unclaim(umm, mm);
+   }
+
+   return ret;
+}
+
+/*
+ *  ksm_scan_frame - hash the next frame of the pass and merge it if an
+ *  equal page is known
+ *
+ *  Return -1 at the end of the pass
+ */
+static int ksm_scan_frame(void)
+{
+   BYTE *page = ksm.page;
+   struct framephy_struct *fp;
+   struct mm_struct *mm;
+   int pgn, fpn, k;
+   uint32_t sum;
+
+   if ((fp = ksm_next_frame(&mm, &pgn)) == NULL)
+     return -1;
+   fpn = fp->fpn;
+
+   /* Pages read ahead and not touched yet are left to readahead */
+   if ((fp->flags & FRAME_RA) || !ksm_pte_maps(mm, pgn, fpn))
+   {
+     mm_unclaim(mm, NULL);
+     return 0;
+   }
+
+   MEMPHY_read_block(ksm.mram, fpn * PAGING_PAGESZ, page, PAGING_PAGESZ);
+   sum = ksm_hash(page);
+
+   /* A page still being written is not worth merging, wait a pass */
+   if (ksm.sum[fpn] != sum)
+   {
+     ksm.sum[fpn] = sum;
+     mm_unclaim(mm, NULL);
+     return 0;
+   }
+
+   pthread_mutex_lock(&ksm.lock);
+   if ((k = ksm_stable_find(page, sum)) < 0 &&
+       (k = ksm_unstable_merge(mm, fpn, page, sum)) < 0 &&
+       ksm.unstable_seq[fpn] != ksm.seq)
+   {
+     ksm.unstable_seq[fpn] = ksm.seq;
+     ksm.unstable_next[fpn] = ksm.unstable[sum % KSM_HASHSZ];
+     ksm.unstable[sum % KSM_HASHSZ] = fpn;
+   }
+   if (k >= 0)
+   {
+     MEMPHY_get_frame(ksm.mram, k)->refcount++;
+     ksm.pages_sharing++;
+     if (ksm.pages_sharing > ksm.max_sharing)
+       ksm.max_sharing = ksm.pages_sharing;
+     ksm.merged++;
+   }
+   pthread_mutex_unlock(&ksm.lock);
+
+   if (k >= 0)
+   {
+     pte_set_fpn(&mm->pgd[pgn], k);
+     SETBIT(mm->pgd[pgn], PAGING_PTE_COW_MASK);
+     swap_drop_copy(ksm.ctx, fpn);
+     MEMPHY_put_freefp(ksm.mram, fpn);
+     memcg_charge(mm, -1, 0);
+   }
+   mm_unclaim(mm, NULL);
+
+   return 0;
+}
+
+static void *ksm_routine(void *arg)
+{
+   int i;
+
+   while (!__atomic_load_n(&ksm.stop, __ATOMIC_ACQUIRE))
+   {
+     for (i = 0; i < ksm.batch; i++)
+       if (ksm_scan_frame() < 0)
+       {
+         /* Pass done, the pages seen in it are forgotten */
+         ksm.seq++;
+         memset(ksm.unstable, 0xff, sizeof(ksm.unstable));
+         ksm.full_scans++;
+         break;
+       }
+
+     next_slot(ksm.timer_id);
+   }
+
+   detach_event(ksm.timer_id);
+   return NULL;
+}
+
+/*
+ *  ksm_start - run the merge scanner of a RAM device
+ *  @mram: RAM device
+ *  @mswp: swap devices the swap copies of merged pages are dropped from
+ *  @timer_id: timer device the scanner runs on, attached before start_timer
+ *  @batch: frames visited per time slot
+ */
+int ksm_start(struct memphy_struct *mram, struct memphy_struct **mswp,
+              struct timer_id_t *timer_id, int batch)
+{
+   int n = mram->maxfpn;
+
+   ksm.ctx = calloc(1, sizeof(struct pcb_t));
+   ksm.sum = calloc(n, sizeof(uint32_t));
+   ksm.stable_next = malloc(n * sizeof(int));
+   ksm.unstable_next = malloc(n * sizeof(int));
+   ksm.unstable_seq = calloc(n, sizeof(int));
+   if (ksm.ctx == NULL || ksm.sum == NULL || ksm.stable_next == NULL ||
+       ksm.unstable_next == NULL || ksm.unstable_seq == NULL)
+     return -1;
+
+   ksm.ctx->mram = mram;
+   ksm.ctx->mswp = mswp;
+   ksm.ctx->active_mswp = mswp[0];
+   ksm.mram = mram;
+   ksm.timer_id = timer_id;
+   ksm.batch = batch;
+   ksm.stop = 0;
+   ksm.seq = 1;
+   memset(ksm.stable, 0xff, sizeof(ksm.stable));
+   memset(ksm.unstable, 0xff, sizeof(ksm.unstable));
+
+   return pthread_create(&ksm.thread, NULL, ksm_routine, NULL);
+}
+
+/*
+ *  ksm_stop - let the scanner leave at its next time slot
+ */
+int ksm_stop(void)
+{
+   __atomic_store_n(&ksm.stop, 1, __ATOMIC_RELEASE);
+   return 0;
+}
+
+/*
+ *  ksm_join - wait for the stopped scanner and report its work
+ */
+int ksm_join(void)
+{
+   pthread_join(ksm.thread, NULL);
+   printf("ksm: %lu full scans, %lu pages merged, %d frames reclaimed at most, %lu copies on write\n",
+          ksm.full_scans, ksm.merged, ksm.max_sharing, ksm.cow_breaks);
+
+   free(ksm.ctx);
+   free(ksm.sum);
+   free(ksm.stable_next);
+   free(ksm.unstable_next);
+   free(ksm.unstable_seq);
+   return 0;
+}
+
+/*
+ *  ksm_put - drop a PTE's reference on a merged frame, caller holds the
+ *  mm lock of the PTE
+ *  @caller: caller
+ *  @fpn: merged frame
+ */
+int ksm_put(struct pcb_t *caller, int fpn)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(caller->mram, fpn);
+
+   pthread_mutex_lock(&ksm.lock);
+   if (--fp->refcount > 0)
+     ksm.pages_sharing--;
+   else {
+     ksm_stable_remove(fpn);
+     ksm.pages_shared--;
+     MEMPHY_put_freefp(caller->mram, fpn);
+   }
+   pthread_mutex_unlock(&ksm.lock);
+
+   return 0;
+}
+
+/*
+ *  ksm_break_cow - give a page mapping a merged frame a private frame
+ *  before it is written, caller holds the mm lock
+ *  @caller: caller
+ *  @mm: mm of the page
+ *  @pgn: page number
+ *  @fpn: merged frame, the private one on return
+ */
+int ksm_break_cow(struct pcb_t *caller, struct mm_struct *mm, int pgn, int *fpn)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(caller->mram, *fpn);
+   int newfpn = *fpn;
+
+   pthread_mutex_lock(&ksm.lock);
+   if (fp->refcount == 1 && memcg_try_charge(mm, MEMCG_RSS) == 0)
+   {
+     /* Last mapper, the frame is taken back as it is */
+     ksm_stable_remove(*fpn);
+     ksm.pages_shared--;
+     fp->flags &= ~FRAME_KSM;
+     pthread_mutex_unlock(&ksm.lock);
+   } else {
+     /* Our reference keeps the frame while it is copied, the last
+      * mapper at its resident limit copies too, after making room */
+     pthread_mutex_unlock(&ksm.lock);
+     if (alloc_frame_may_oom(caller, &newfpn) < 0)
+       return -1;
+     __swap_cp_page(caller->mram, *fpn, caller->mram, newfpn);
+     ksm_put(caller, *fpn);
+   }
+
+   pte_set_fpn(&mm->pgd[pgn], newfpn);
+   CLRBIT(mm->pgd[pgn], PAGING_PTE_COW_MASK);
+   MEMPHY_put_usedfp(caller->mram, newfpn, mm, pgn);
+   __sync_fetch_and_add(&ksm.cow_breaks, 1);
+   *fpn = newfpn;
+
+   return 0;
+}
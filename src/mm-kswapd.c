@@ -0,0 +1,103 @@
+/*
+ * PAGING based Memory Management
+ * Background reclaim mm/mm-kswapd.c
+ *
+ * One daemon per MEMRAM device runs as a timer device, once per time
+ * slot it looks at the free frames. Below the low watermark it wakes up
+ * and evicts the globally oldest pages, at most KSWAPD_BATCH per slot,
+ * until the high watermark is reached. Faults then mostly find a free
+ * frame and do not pay for the eviction themselves.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+static void *kswapd_routine(void *arg)
+{
+   struct kswapd_struct *kd = arg;
+   int active = 0, nfree, fpn, i;
+
+   while (!__atomic_load_n(&kd->stop, __ATOMIC_ACQUIRE))
+   {
+     nfree = MEMPHY_nr_freefp(kd->mram);
+     if (!active && nfree < kd->low)
+     {
+       active = 1;
+       kd->wakeups++;
+     }
+
+     for (i = 0; active && i < KSWAPD_BATCH; i++)
+     {
+       if (nfree >= kd->high || swap_out_victim(kd->ctx, &fpn) < 0)
+       {
+         active = 0;
+         break;
+       }
+       MEMPHY_put_freefp(kd->mram, fpn);
+       kd->reclaimed++;
+       nfree++;
+     }
+
+     next_slot(kd->timer_id);
+   }
+
+   kmem_cache_drain();
+   detach_event(kd->timer_id);
+   return NULL;
+}
+
+/*
+ *  kswapd_start - run the reclaim daemon of a RAM device
+ *  @kd: daemon
+ *  @mram: RAM device
+ *  @mswp: swap devices pages are evicted to
+ *  @timer_id: timer device the daemon runs on, attached before start_timer
+ *  @low: free frames that wake the daemon
+ *  @high: free frames it reclaims up to
+ */
+int kswapd_start(struct kswapd_struct *kd, struct memphy_struct *mram,
+                 struct memphy_struct **mswp, struct timer_id_t *timer_id,
+                 int low, int high)
+{
+   kd->ctx = calloc(1, sizeof(struct pcb_t));
+   if (kd->ctx == NULL)
+     return -1;
+
+   kd->ctx->mram = mram;
+   kd->ctx->mswp = mswp;
+   kd->ctx->active_mswp = mswp[0];
+   kd->mram = mram;
+   kd->timer_id = timer_id;
+   kd->low = low;
+   kd->high = (high > low) ? high : low;
+   kd->stop = 0;
+   kd->wakeups = kd->reclaimed = 0;
+
+   return pthread_create(&kd->thread, NULL, kswapd_routine, kd);
+}
+
+/*
+ *  kswapd_stop - let the daemon leave at its next time slot
+ *  @kd: daemon
+ */
+int kswapd_stop(struct kswapd_struct *kd)
+{
+   __atomic_store_n(&kd->stop, 1, __ATOMIC_RELEASE);
+   return 0;
+}
+
+/*
+ *  kswapd_join - wait for a stopped daemon and report its work
+ *  @kd: daemon
+ */
+int kswapd_join(struct kswapd_struct *kd)
+{
+   pthread_join(kd->thread, NULL);
+   printf("kswapd: %lu wakeups, %lu pages reclaimed\n", kd->wakeups, kd->reclaimed);
+   free(kd->ctx);
+
+   return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * PAGING based Memory Management
+ * Load control mm/mm-loadctl.c
+ *
+ * Time is cut in windows of a few time slots. Every process counts the
+ * frames its faults take and the distinct pages it touches in the
+ * current window, its working set: a frame is stamped with the window
+ * of its last touch, the first touch in a window adds the page.
+ *
+ * An optional daemon runs as a timer device and sums the faults of all
+ * processes over the last window, slot by slot. The system thrashes
+ * when that rate reaches the configured level while the free frames of
+ * MEMRAM are at the low mark: the lowest priority ready process holding
+ * frames is then taken out of the MLQ (deactivate_proc), one per window,
+ * and its pages are swapped out so the others get its frames. Its mm is
+ * claimed while it is still in the queues, which keeps it alive for the
+ * swap-out.
+ * Once the rate falls under half the level and the free frames above
+ * the mark can hold the working set of the first process taken out, it
+ * is put back (reactivate_proc) and faults its pages in again. A CPU
+ * with nothing else to run takes a deactivated process back by itself.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include "sched.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+
+static struct {
+   struct memphy_struct *mram;
+   struct pcb_t *ctx;           /* devices to swap to, mm being swapped out */
+   struct timer_id_t *timer_id;
+   pthread_t thread;
+   int window;                  /* slots per window, 0: load control off */
+   int high;                    /* faults per window of a thrashing system */
+   int low;                     /* free frames near none */
+   int stop;
+
+   unsigned long faults;        /* frames taken on faults so far */
+   int *hist;                   /* faults of the last slots, a ring */
+   int room;                    /* free frames above the low mark */
+
+   unsigned long thrash_slots, deactivated, reactivated, swapped;
+   int peak_rate;
+} loadctl;
+
+/*
+ *  loadctl_window - current window, counted from 1
+ */
+static unsigned int loadctl_window(void)
+{
+   return current_time() / loadctl.window + 1;
+}
+
+/*
+ *  loadctl_touch - account an access of a process to a page, mm held
+ *  @mm: mm of the process
+ *  @mram: RAM device
+ *  @fpn: frame the page is in
+ *  @fault: the access took the frame, zero filled or swapped in
+ */
+void loadctl_touch(struct mm_struct *mm, struct memphy_struct *mram, int fpn, int fault)
+{
+   struct mm_wstat *ws = &mm->wstat;
+   struct framephy_struct *fp;
+   unsigned int win;
+
+   if (loadctl.window == 0)
+     return;
+
+   win = loadctl_window();
+   if (ws->win != win)
+   {
+     /* Counts of a window the process ran in are kept for the daemon */
+     if (ws->faults > 0 || ws->wss > 0)
+     {
+       __atomic_store_n(&ws->last_faults, ws->faults, __ATOMIC_RELAXED);
+       __atomic_store_n(&ws->last_wss, ws->wss, __ATOMIC_RELAXED);
+       if (ws->faults > ws->peak_faults)
+         ws->peak_faults = ws->faults;
+       if (ws->wss > ws->peak_wss)
+         ws->peak_wss = ws->wss;
+     }
+     ws->win = win;
+     ws->faults = ws->wss = 0;
+   }
+
+   if (fault)
+   {
+     ws->faults++;
+     ws->nr_faults++;
+     __sync_fetch_and_add(&loadctl.faults, 1);
+   }
+
+   /* Sharers race on the stamp, the first one counts the page */
+   fp = MEMPHY_get_frame(mram, fpn);
+   if (fp != NULL && __atomic_exchange_n(&fp->ws_win, win, __ATOMIC_RELAXED) != win)
+     ws->wss++;
+}
+
+/*
+ *  loadctl_exit - report the counts of an exiting process, mm held
+ *  @proc: process
+ */
+void loadctl_exit(struct pcb_t *proc)
+{
+   struct mm_wstat *ws = &proc->mm->wstat;
+
+   if (loadctl.window == 0)
+     return;
+
+   if (ws->faults > ws->peak_faults)
+     ws->peak_faults = ws->faults;
+   if (ws->wss > ws->peak_wss)
+     ws->peak_wss = ws->wss;
+   printf("\tLoad control: process %2d %lu faults, peak %d faults and %d pages per window\n",
+          proc->pid, ws->nr_faults, ws->peak_faults, ws->peak_wss);
+}
+
+/*
+ *  loadctl_claim - claim the mm of a process to be deactivated, called
+ *  under the queue lock; a busy mm, or one with no page in RAM to give
+ *  back, leaves the process where it is
+ */
+static int loadctl_claim(struct pcb_t *proc)
+{
+   if (mm_claim(proc->mm, NULL) < 0)
+     return 0;
+
+   if (proc->mm->memcg_usage[MEMCG_RSS] == 0)
+   {
+     mm_unclaim(proc->mm, NULL);
+     return 0;
+   }
+
+   loadctl.ctx->mm = proc->mm;
+   return 1;
+}
+
+/*
+ *  loadctl_admit - the free frames above the low mark hold the last
+ *  working set of a deactivated process, called under the queue lock
+ */
+static int loadctl_admit(struct pcb_t *proc)
+{
+   return __atomic_load_n(&proc->mm->wstat.last_wss, __ATOMIC_RELAXED) <= loadctl.room;
+}
+
+static void *loadctl_routine(void *arg)
+{
+   unsigned long seen = 0, now;
+   int rate = 0, hold = 0, slot = 0, nfree, n;
+   struct pcb_t *proc;
+
+   while (!__atomic_load_n(&loadctl.stop, __ATOMIC_ACQUIRE))
+   {
+     /* Faults over the last window, one slot replaced at a time */
+     now = __atomic_load_n(&loadctl.faults, __ATOMIC_RELAXED);
+     rate += (int)(now - seen) - loadctl.hist[slot];
+     loadctl.hist[slot] = (int)(now - seen);
+     slot = (slot + 1) % loadctl.window;
+     seen = now;
+     if (rate > loadctl.peak_rate)
+       loadctl.peak_rate = rate;
+
+     nfree = MEMPHY_nr_freefp(loadctl.mram);
+     if (hold > 0)
+       hold--;
+
+     if (rate >= loadctl.high && nfree <= loadctl.low)
+     {
+       loadctl.thrash_slots++;
+       if (hold == 0 && (proc = deactivate_proc(loadctl_claim)) != NULL)
+       {
+         n = swap_out_mm(loadctl.ctx, INT_MAX);
+         mm_unclaim(loadctl.ctx->mm, NULL);
+         loadctl.ctx->mm = NULL;
+
+         printf("\tLoad control: deactivated process %2d, %d faults in %d slots, %d free frames, %d pages swapped out\n",
+                proc->pid, rate, loadctl.window, nfree, n);
+         loadctl.deactivated++;
+         loadctl.swapped += n;
+         hold = loadctl.window;
+       }
+     }
+     else if (hold == 0 && 2 * rate < loadctl.high && nfree > loadctl.low)
+     {
+       loadctl.room = nfree - loadctl.low;
+       if ((proc = reactivate_proc(loadctl_admit)) != NULL)
+       {
+         printf("\tLoad control: reactivated process %2d, %d faults in %d slots, %d free frames\n",
+                proc->pid, rate, loadctl.window, nfree);
+         loadctl.reactivated++;
+         hold = loadctl.window;
+       }
+     }
+
+     next_slot(loadctl.timer_id);
+   }
+
+   kmem_cache_drain();
+   detach_event(loadctl.timer_id);
+   return NULL;
+}
+
+/*
+ *  loadctl_init - count faults and working sets per window
+ *  @window: time slots per window
+ */
+int loadctl_init(int window)
+{
+   loadctl.window = (window > 0) ? window : LOADCTL_WINDOW;
+   return 0;
+}
+
+/*
+ *  loadctl_start - run the load control daemon, after loadctl_init
+ *  @mram: RAM device
+ *  @mswp: swap devices the pages of deactivated processes go to
+ *  @timer_id: timer device the daemon runs on, attached before start_timer
+ *  @high: faults per window of a thrashing system
+ *  @low: free frames of a thrashing system
+ */
+int loadctl_start(struct memphy_struct *mram, struct memphy_struct **mswp,
+                  struct timer_id_t *timer_id, int high, int low)
+{
+   loadctl.ctx = calloc(1, sizeof(struct pcb_t));
+   loadctl.hist = calloc(loadctl.window, sizeof(int));
+   if (loadctl.ctx == NULL || loadctl.hist == NULL)
+     return -1;
+
+   loadctl.ctx->mram = mram;
+   loadctl.ctx->mswp = mswp;
+   loadctl.ctx->active_mswp = mswp[0];
+   loadctl.mram = mram;
+   loadctl.timer_id = timer_id;
+   loadctl.high = high;
+   loadctl.low = low;
+   loadctl.stop = 0;
+
+   return pthread_create(&loadctl.thread, NULL, loadctl_routine, NULL);
+}
+
+/*
+ *  loadctl_stop - let the daemon leave at its next time slot
+ */
+int loadctl_stop(void)
+{
+   __atomic_store_n(&loadctl.stop, 1, __ATOMIC_RELEASE);
+   return 0;
+}
+
+/*
+ *  loadctl_join - wait for the stopped daemon and report its work
+ */
+int loadctl_join(void)
+{
+   pthread_join(loadctl.thread, NULL);
+   printf("loadctl: %lu faults, peak %d per %d slots, %lu slots thrashing, "
+          "%lu deactivations, %lu pages swapped out, %lu reactivations\n",
+          loadctl.faults, loadctl.peak_rate, loadctl.window, loadctl.thrash_slots,
+          loadctl.deactivated, loadctl.swapped, loadctl.reactivated);
+
+   free(loadctl.ctx);
+   free(loadctl.hist);
+   return 0;
+}
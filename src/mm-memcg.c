@@ -0,0 +1,220 @@
+/*
+ * PAGING based Memory Management
+ * Memory limits mm/mm-memcg.c
+ *
+ * A process line of the config may cap the frames a process keeps in
+ * MEMRAM and the swap it fills, alone or shared with the other members
+ * of a group. Every private page of a member is charged to the group
+ * while it is online or swapped, the mm keeps its own share too.
+ *
+ * A member at its resident limit does not take a free frame or a page
+ * of another process: it swaps out one of its own pages first (FIFO
+ * order), then one of its group's (swap_out_local). A page of a group
+ * at its swap limit is never swapped out, global eviction passes it
+ * over. A charge that can not be made room for goes to the OOM killer,
+ * which then only picks a member of the group.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+
+static struct {
+   struct mm_memcg *list;
+   pthread_mutex_t lock;
+} memcg = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ *  memcg_attach - put a loaded process under its limits
+ *  @proc: process, its mm is set up
+ *  @id: group of the config, 0 for limits of its own
+ *  @rss_max: resident frames, 0: no limit
+ *  @swp_max: swap pages, 0: no limit
+ *
+ *  A group takes the limits given with its first member
+ */
+int memcg_attach(struct pcb_t *proc, int id, int rss_max, int swp_max)
+{
+   struct mm_memcg *cg = NULL;
+
+   proc->mm->memcg = NULL;
+   if (id <= 0 && rss_max <= 0 && swp_max <= 0)
+     return 0;
+
+   pthread_mutex_lock(&memcg.lock);
+   if (id > 0)
+     for (cg = memcg.list; cg != NULL && cg->id != id; cg = cg->next);
+
+   if (cg == NULL)
+   {
+     cg = calloc(1, sizeof(*cg));
+     if (cg == NULL)
+     {
+       pthread_mutex_unlock(&memcg.lock);
+       return -1;
+     }
+     cg->id = (id > 0) ? id : -(int)proc->pid;
+     cg->max[MEMCG_RSS] = (rss_max > 0) ? rss_max : 0;
+     cg->max[MEMCG_SWP] = (swp_max > 0) ? swp_max : 0;
+     cg->next = memcg.list;
+     memcg.list = cg;
+   }
+   cg->nr_proc++;
+   pthread_mutex_unlock(&memcg.lock);
+
+   proc->mm->memcg = cg;
+   return 0;
+}
+
+/*
+ *  memcg_detach - take an exiting process out of its group, after its
+ *  pages are released; the group stays for later members and the dump
+ */
+void memcg_detach(struct mm_struct *mm)
+{
+   struct mm_memcg *cg = mm->memcg;
+
+   if (cg == NULL)
+     return;
+
+   /* Whatever is still charged goes with it */
+   memcg_charge(mm, -mm->memcg_usage[MEMCG_RSS], -mm->memcg_usage[MEMCG_SWP]);
+
+   pthread_mutex_lock(&memcg.lock);
+   cg->nr_proc--;
+   pthread_mutex_unlock(&memcg.lock);
+   mm->memcg = NULL;
+}
+
+static void memcg_peak(struct mm_memcg *cg, int type, int v)
+{
+   int p = __atomic_load_n(&cg->peak[type], __ATOMIC_RELAXED);
+
+   while (v > p && !__atomic_compare_exchange_n(&cg->peak[type], &p, v, 0,
+                                               __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ *  memcg_try_charge - charge one page if the limit leaves room, mm held
+ *  @mm: mm the page belongs to
+ *  @type: MEMCG_RSS or MEMCG_SWP
+ */
+int memcg_try_charge(struct mm_struct *mm, int type)
+{
+   struct mm_memcg *cg = mm->memcg;
+   int v;
+
+   if (cg != NULL)
+   {
+     v = __atomic_load_n(&cg->usage[type], __ATOMIC_RELAXED);
+     do {
+       if (cg->max[type] > 0 && v >= cg->max[type])
+         return -1;
+     } while (!__atomic_compare_exchange_n(&cg->usage[type], &v, v + 1, 0,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+     memcg_peak(cg, type, v + 1);
+   }
+   mm->memcg_usage[type]++;
+
+   return 0;
+}
+
+/*
+ *  memcg_charge - account pages whatever the limits, mm held
+ *  @mm: mm the pages belong to
+ *  @nrss: resident pages, negative to uncharge
+ *  @nswp: swapped pages, negative to uncharge
+ */
+void memcg_charge(struct mm_struct *mm, int nrss, int nswp)
+{
+   struct mm_memcg *cg = mm->memcg;
+
+   mm->memcg_usage[MEMCG_RSS] += nrss;
+   mm->memcg_usage[MEMCG_SWP] += nswp;
+   if (cg == NULL)
+     return;
+
+   if (nrss != 0)
+     memcg_peak(cg, MEMCG_RSS, __atomic_add_fetch(&cg->usage[MEMCG_RSS], nrss, __ATOMIC_RELAXED));
+   if (nswp != 0)
+     memcg_peak(cg, MEMCG_SWP, __atomic_add_fetch(&cg->usage[MEMCG_SWP], nswp, __ATOMIC_RELAXED));
+}
+
+/*
+ *  memcg_room - pages the group of an mm may still be charged
+ *  @mm: mm
+ *  @type: MEMCG_RSS or MEMCG_SWP
+ *
+ *  Return INT_MAX without a limit
+ */
+int memcg_room(struct mm_struct *mm, int type)
+{
+   struct mm_memcg *cg = mm->memcg;
+
+   if (cg == NULL || cg->max[type] == 0)
+     return INT_MAX;
+
+   return cg->max[type] - __atomic_load_n(&cg->usage[type], __ATOMIC_RELAXED);
+}
+
+/*
+ *  memcg_evictable - a used frame may be swapped out, memphy lock held
+ *  @fp: frame on the used list
+ *  @memcg: group the frame must belong to, NULL for any
+ */
+int memcg_evictable(struct framephy_struct *fp, struct mm_memcg *memcg)
+{
+   if ((fp->flags & FRAME_SHM) || fp->owner == NULL)
+     return memcg == NULL;
+   if (memcg != NULL && fp->owner->memcg != memcg)
+     return 0;
+
+   return memcg_room(fp->owner, MEMCG_SWP) > 0;
+}
+
+/*
+ *  memcg_query - usage and limit of a process
+ *  @mm: mm of the process
+ *  @type: MEMCG_RSS or MEMCG_SWP
+ *  @usage: pages charged by the process
+ *  @grpusage: pages charged by its group, NULL to skip
+ *  @max: limit of its group, 0: none, NULL to skip
+ */
+int memcg_query(struct mm_struct *mm, int type, int *usage, int *grpusage, int *max)
+{
+   struct mm_memcg *cg = mm->memcg;
+
+   if (type < 0 || type >= MEMCG_NR)
+     return -1;
+
+   *usage = mm->memcg_usage[type];
+   if (grpusage != NULL)
+     *grpusage = (cg != NULL) ? __atomic_load_n(&cg->usage[type], __ATOMIC_RELAXED)
+                              : *usage;
+   if (max != NULL)
+     *max = (cg != NULL) ? cg->max[type] : 0;
+
+   return 0;
+}
+
+/*
+ *  memcg_dump - print the usage peaks of every limited process and group
+ */
+int memcg_dump(void)
+{
+   struct mm_memcg *cg;
+
+   pthread_mutex_lock(&memcg.lock);
+   for (cg = memcg.list; cg != NULL; cg = cg->next)
+     printf("memcg %s %d: frames peak %d max %d, swap peak %d max %d, "
+            "%lu reclaimed, %lu refused\n",
+            (cg->id > 0) ? "group" : "process", (cg->id > 0) ? cg->id : -cg->id,
+            cg->peak[MEMCG_RSS], cg->max[MEMCG_RSS],
+            cg->peak[MEMCG_SWP], cg->max[MEMCG_SWP],
+            cg->reclaims, cg->failures);
+   pthread_mutex_unlock(&memcg.lock);
+
+   return 0;
+}
@@ -6,22 +6,26 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #ifdef MM_PAGING
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
  *  @mp: memphy struct
  *  @offset: offset
+ *
+ *  The cursor rewinds then traverses sequentially up to offset, every
+ *  step is charged to csr_steps as the cost of the serial access.
  */
 int MEMPHY_mv_csr(struct memphy_struct *mp, int offset)
 {
-   int numstep = 0;
+   int numstep = (offset < mp->maxsz) ? offset : mp->maxsz;
 
-   mp->cursor = 0;
-   while(numstep < offset && numstep < mp->maxsz){
-     /* Traverse sequentially */
-     mp->cursor = (mp->cursor + 1) % mp->maxsz;
-     numstep++;
-   }
+   mp->cursor = numstep % mp->maxsz;
+   mp->csr_steps += numstep;
 
    return 0;
 }
@@ -37,7 +41,7 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
    if (mp == NULL)
      return -1;
 
-   if (!mp->rdmflg)
+   if (mp->rdmflg)
      return -1; /* Not compatible mode for sequential read */
 
    MEMPHY_mv_csr(mp, addr);
@@ -77,8 +81,8 @@ int MEMPHY_seq_write(struct memphy_struct * mp, int addr, BYTE value)
    if (mp == NULL)
      return -1;
 
-   if (!mp->rdmflg)
-     return -1; /* Not compatible mode for sequential read */
+   if (mp->rdmflg)
+     return -1; /* Not compatible mode for sequential write */
 
    MEMPHY_mv_csr(mp, addr);
    mp->storage[addr] = value;
@@ -105,150 +109,603 @@ int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data)
    return 0;
 }
 
+/*
+ *  MEMPHY_seq_block - position a serial device for a block transfer
+ *  One seek to addr, then the cursor streams over len cells.
+ */
+static void MEMPHY_seq_block(struct memphy_struct *mp, int addr, int len)
+{
+   MEMPHY_mv_csr(mp, addr);
+   mp->cursor = (addr + len) % mp->maxsz;
+   mp->csr_steps += len;
+}
+
+/*
+ *  MEMPHY_read_block - read len bytes of MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: start address
+ *  @buf: destination buffer
+ *  @len: number of bytes
+ */
+int MEMPHY_read_block(struct memphy_struct *mp, int addr, BYTE *buf, int len)
+{
+   if (mp == NULL || addr < 0 || len < 0 || addr + len > mp->maxsz)
+     return -1;
+
+   if (!mp->rdmflg) /* Sequential access device */
+     MEMPHY_seq_block(mp, addr, len);
+
+   memcpy(buf, mp->storage + addr, len);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_write_block - write len bytes to MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: start address
+ *  @buf: source buffer
+ *  @len: number of bytes
+ */
+int MEMPHY_write_block(struct memphy_struct *mp, int addr, const BYTE *buf, int len)
+{
+   if (mp == NULL || addr < 0 || len < 0 || addr + len > mp->maxsz)
+     return -1;
+
+   if (!mp->rdmflg) /* Sequential access device */
+     MEMPHY_seq_block(mp, addr, len);
+
+   memcpy(mp->storage + addr, buf, len);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_copy_frame - copy a whole frame between MEMPHY devices
+ *  @mpsrc: source memphy
+ *  @srcfpn: source frame
+ *  @mpdst: destination memphy
+ *  @dstfpn: destination frame
+ *
+ *  Storage is copied to storage in one memcpy, a serial device on
+ *  either side has its cursor moved as a block transfer would.
+ */
+int MEMPHY_copy_frame(struct memphy_struct *mpsrc, int srcfpn,
+                      struct memphy_struct *mpdst, int dstfpn)
+{
+   int addrsrc = srcfpn * PAGING_PAGESZ;
+   int addrdst = dstfpn * PAGING_PAGESZ;
+
+   if (mpsrc == NULL || mpdst == NULL ||
+       addrsrc < 0 || addrsrc + PAGING_PAGESZ > mpsrc->maxsz ||
+       addrdst < 0 || addrdst + PAGING_PAGESZ > mpdst->maxsz)
+     return -1;
+
+   mpsrc->io_cost += mpsrc->lat;
+   mpdst->io_cost += mpdst->lat;
+
+   if (!mpsrc->rdmflg)
+     MEMPHY_seq_block(mpsrc, addrsrc, PAGING_PAGESZ);
+   if (!mpdst->rdmflg)
+     MEMPHY_seq_block(mpdst, addrdst, PAGING_PAGESZ);
+
+   memcpy(mpdst->storage + addrdst, mpsrc->storage + addrsrc, PAGING_PAGESZ);
+   return 0;
+}
+
+/*
+ *  MEMPHY_set_latency - set the simulated cost of a frame transfer
+ *  @mp: memphy struct
+ *  @lat: cost charged to io_cost per frame moved in or out
+ */
+int MEMPHY_set_latency(struct memphy_struct *mp, int lat)
+{
+   mp->lat = lat;
+   return 0;
+}
+
+/*
+ *  MEMPHY_zero_frame - clear a whole frame of MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame
+ */
+int MEMPHY_zero_frame(struct memphy_struct *mp, int fpn)
+{
+   static const BYTE zero[PAGING_MAX_PAGESZ];
+
+   return MEMPHY_write_block(mp, fpn * PAGING_PAGESZ, zero, PAGING_PAGESZ);
+}
+
+/*
+ *  MEMPHY_reserve - zeroed backing memory for a device
+ *  @size: bytes
+ *
+ *  Large areas are only reserved as address space, the host commits
+ *  each page on its first touch, so untouched frames cost nothing.
+ */
+static void *MEMPHY_reserve(size_t size)
+{
+   void *p;
+
+   if (size < MEMPHY_NORESERVE_MIN)
+     return calloc(1, size);
+
+   p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   return (p == MAP_FAILED) ? NULL : p;
+}
+
+/*
+ *  MEMPHY_unreserve - give back memory of MEMPHY_reserve
+ *  @p: memory, NULL for none
+ *  @size: bytes, as reserved
+ */
+static void MEMPHY_unreserve(void *p, size_t size)
+{
+   if (size < MEMPHY_NORESERVE_MIN)
+     free(p);
+   else if (p != NULL)
+     munmap(p, size);
+}
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
+ *
+ *  Reserves the frame table, one framephy_struct per FPN. No entry is
+ *  written here: frames from fresh_fpn up are free by definition and
+ *  their entry is set up the first time the frame is handed out, so
+ *  formatting costs the same for any device size.
  */
 int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 {
     /* This setting come with fixed constant PAGESZ */
     int numfp = mp->maxsz / pagesz;
-    struct framephy_struct *newfst, *fst;
-    int iter = 0;
+
+    mp->frmtbl = NULL;
+    mp->maxfpn = 0;
+    mp->free_fp_list = NULL;
+    mp->nr_free = 0;
+    mp->fresh_fpn = 0;
+    mp->used_fp_list = mp->used_fp_tail = NULL;
 
     if (numfp <= 0)
       return -1;
 
-    /* Init head of free framephy list */ 
-    fst = malloc(sizeof(struct framephy_struct));
-    fst->fpn = iter;
-    mp->free_fp_list = fst;
-
-    /* We have list with first element, fill in the rest num-1 element member*/
-    for (iter = 1; iter < numfp ; iter++)
-    {
-       newfst =  malloc(sizeof(struct framephy_struct));
-       newfst->fpn = iter;
-       newfst->fp_next = NULL;
-       fst->fp_next = newfst;
-       fst = newfst;
-    }
+    mp->frmtbl = MEMPHY_reserve(numfp * sizeof(struct framephy_struct));
+    if (mp->frmtbl == NULL)
+      return -1;
+    mp->maxfpn = numfp;
+    mp->nr_free = numfp;
 
     return 0;
 }
 
-int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
+/*
+ *  MEMPHY_get_frame - frame table lookup
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *
+ *  A frame never handed out has no valid entry yet and is reported as
+ *  missing.
+ */
+struct framephy_struct *MEMPHY_get_frame(struct memphy_struct *mp, int fpn)
+{
+   if (mp->frmtbl == NULL || fpn < 0 ||
+       fpn >= __atomic_load_n(&mp->fresh_fpn, __ATOMIC_ACQUIRE))
+     return NULL;
+
+   return &mp->frmtbl[fpn];
+}
+
+/*
+ *  __MEMPHY_get_freefp - pop a frame from the device free list
+ *  Recycled frames go first, then the never used ones in ascending FPN
+ *  order, the same order a fully threaded free list would give.
+ *  Caller must hold mp->lock
+ */
+static int __MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 {
    struct framephy_struct *fp = mp->free_fp_list;
 
    if (fp == NULL)
-     return -1;
+   {
+     if (mp->fresh_fpn >= mp->maxfpn)
+       return -1;
+
+     fp = &mp->frmtbl[mp->fresh_fpn];
+     fp->fpn = mp->fresh_fpn;
+     fp->swptyp = 0;
+     /* Published last, MEMPHY_get_frame reads it without the lock */
+     __atomic_store_n(&mp->fresh_fpn, fp->fpn + 1, __ATOMIC_RELEASE);
+     *retfpn = fp->fpn;
+     mp->nr_free--;
+     return 0;
+   }
 
    *retfpn = fp->fpn;
    mp->free_fp_list = fp->fp_next;
+   fp->fp_next = NULL;
+   mp->nr_free--;
 
-   /* MEMPHY is iteratively used up until its exhausted
-    * No garbage collector acting then it not been released
-    */
-   free(fp);
+   return 0;
+}
+
+/*
+ *  __MEMPHY_put_freefp - push a frame on the device free list
+ *  Caller must hold mp->lock
+ */
+static int __MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
+{
+   struct framephy_struct *fp = &mp->frmtbl[fpn];
+
+   fp->fp_next = mp->free_fp_list;
+   mp->free_fp_list = fp;
+   mp->nr_free++;
 
    return 0;
 }
 
+/*
+ *  MEMPHY_frame_reset - mark frame free and drop its ownership
+ */
+static void MEMPHY_frame_reset(struct memphy_struct *mp, int fpn, int flags)
+{
+   struct framephy_struct *fp = &mp->frmtbl[fpn];
+
+   fp->fp_next = fp->fp_prev = NULL;
+   fp->fifo_next = fp->fifo_prev = NULL;
+   fp->owner = NULL;
+   fp->pgn = -1;
+   fp->flags = flags;
+   fp->refcount = (flags & FRAME_FREE) ? 0 : 1;
+   fp->swpoff = -1;
+   fp->ws_win = 0;
+}
+
+/*
+ *  Per-CPU frame caches
+ *  Every CPU thread keeps a small stack of free FPNs in front of the
+ *  shared free_fp_list. Frames move between the cache and the device
+ *  list pcp_batch at a time, so the device lock is taken once per batch
+ *  instead of once per page fault. Threads not bound to a CPU (loader,
+ *  daemons) go straight to the device list.
+ */
+static __thread int memphy_cpu = -1;
+
+/*
+ *  MEMPHY_bind_cpu - bind calling thread to a per-CPU cache slot
+ *  @cpu: cpu id, negative to unbind
+ */
+void MEMPHY_bind_cpu(int cpu)
+{
+   memphy_cpu = cpu;
+}
+
+static struct memphy_pcp *MEMPHY_this_pcp(struct memphy_struct *mp)
+{
+   if (mp->pcp == NULL || memphy_cpu < 0 || memphy_cpu >= mp->npcp)
+     return NULL;
+
+   return &mp->pcp[memphy_cpu];
+}
+
+/*
+ *  MEMPHY_pcp_refill - move up to one batch from device list to cache
+ *  The batch is stacked in reverse so the frames come out of the cache
+ *  in the order the device list gave them.
+ *  Caller must hold pcp->lock
+ */
+static int MEMPHY_pcp_refill(struct memphy_struct *mp, struct memphy_pcp *pcp)
+{
+   int fpn, lo = pcp->count, hi;
+
+   pthread_mutex_lock(&mp->lock);
+   while (pcp->count < mp->pcp_batch && __MEMPHY_get_freefp(mp, &fpn) == 0)
+     pcp->fpn[pcp->count++] = fpn;
+   pthread_mutex_unlock(&mp->lock);
+
+   for (hi = pcp->count - 1; lo < hi; lo++, hi--)
+   {
+     fpn = pcp->fpn[lo];
+     pcp->fpn[lo] = pcp->fpn[hi];
+     pcp->fpn[hi] = fpn;
+   }
+
+   return pcp->count;
+}
+
+/*
+ *  MEMPHY_pcp_drain - give one batch from the cache back to device list
+ *  Caller must hold pcp->lock
+ */
+static void MEMPHY_pcp_drain(struct memphy_struct *mp, struct memphy_pcp *pcp, int nr)
+{
+   pthread_mutex_lock(&mp->lock);
+   while (nr-- > 0 && pcp->count > 0)
+     __MEMPHY_put_freefp(mp, pcp->fpn[--pcp->count]);
+   pthread_mutex_unlock(&mp->lock);
+}
+
+/*
+ *  MEMPHY_pcp_steal - take a frame cached by any CPU
+ *  Used when the device list ran dry but other caches still hold frames,
+ *  so a small device is not reported exhausted while frames sit idle.
+ */
+static int MEMPHY_pcp_steal(struct memphy_struct *mp, int *retfpn)
+{
+   int cpu;
+
+   for (cpu = 0; cpu < mp->npcp; cpu++)
+   {
+     struct memphy_pcp *pcp = &mp->pcp[cpu];
+
+     pthread_mutex_lock(&pcp->lock);
+     if (pcp->count > 0) {
+        *retfpn = pcp->fpn[--pcp->count];
+        pthread_mutex_unlock(&pcp->lock);
+        return 0;
+     }
+     pthread_mutex_unlock(&pcp->lock);
+   }
+
+   return -1;
+}
+
+int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
+{
+   struct memphy_pcp *pcp = MEMPHY_this_pcp(mp);
+   int ret;
+
+   if (pcp != NULL) {
+      pthread_mutex_lock(&pcp->lock);
+      if (pcp->count > 0 || MEMPHY_pcp_refill(mp, pcp) > 0) {
+         *retfpn = pcp->fpn[--pcp->count];
+         pthread_mutex_unlock(&pcp->lock);
+         MEMPHY_frame_reset(mp, *retfpn, 0);
+         return 0;
+      }
+      pthread_mutex_unlock(&pcp->lock);
+   }
+
+   pthread_mutex_lock(&mp->lock);
+   ret = __MEMPHY_get_freefp(mp, retfpn);
+   pthread_mutex_unlock(&mp->lock);
+
+   if (ret < 0 && mp->pcp != NULL)
+     ret = MEMPHY_pcp_steal(mp, retfpn);
+
+   /* The frame is now in transit: on no list, owned by the caller */
+   if (ret == 0)
+     MEMPHY_frame_reset(mp, *retfpn, 0);
+
+   return ret;
+}
+
+/*
+ *  MEMPHY_nr_freefp - number of free frames, including per-CPU caches
+ *  @mp: memphy struct
+ *
+ *  Each count is read under its own lock, frames moving between the
+ *  lists meanwhile make the sum a hint
+ */
+int MEMPHY_nr_freefp(struct memphy_struct *mp)
+{
+   int nr, i;
+
+   pthread_mutex_lock(&mp->lock);
+   nr = mp->nr_free;
+   pthread_mutex_unlock(&mp->lock);
+
+   for (i = 0; i < mp->npcp; i++)
+   {
+     pthread_mutex_lock(&mp->pcp[i].lock);
+     nr += mp->pcp[i].count;
+     pthread_mutex_unlock(&mp->pcp[i].lock);
+   }
+
+   return nr;
+}
+
 int MEMPHY_dump(struct memphy_struct * mp)
 {
     /*TODO dump memphy contnt mp->storage 
      *     for tracing the memory content
      */
+    /* Frames never handed out hold nothing, stop at the first of them */
+    int end = __atomic_load_n(&mp->fresh_fpn, __ATOMIC_ACQUIRE) * PAGING_PAGESZ;
+
     printf("----------------MEMORY CONTENT-------------- \n");
     printf("Address: Content \n");
-    for (int i = 0; i < mp->maxsz; i++)
+    for (int i = 0; i < end && i < mp->maxsz; i++)
       if (mp->storage[i]) printf("0x%08x: %08x \n", i, mp->storage[i]);
     return 0;
 }
 
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   struct memphy_pcp *pcp = MEMPHY_this_pcp(mp);
 
-   /* Create new node with value fpn */
-   newnode->fpn = fpn;
-   newnode->fp_next = fp;
-   mp->free_fp_list = newnode;
+   if (MEMPHY_get_frame(mp, fpn) == NULL)
+     return -1;
+
+   if (mp->frmtbl[fpn].flags & FRAME_USED)
+     MEMPHY_remove_usedfp(mp, fpn);
+   MEMPHY_frame_reset(mp, fpn, FRAME_FREE);
+
+   if (pcp != NULL) {
+      pthread_mutex_lock(&pcp->lock);
+      if (pcp->count == 2 * mp->pcp_batch)
+        MEMPHY_pcp_drain(mp, pcp, mp->pcp_batch);
+      pcp->fpn[pcp->count++] = fpn;
+      pthread_mutex_unlock(&pcp->lock);
+      return 0;
+   }
+
+   pthread_mutex_lock(&mp->lock);
+   __MEMPHY_put_freefp(mp, fpn);
+   pthread_mutex_unlock(&mp->lock);
 
    return 0;
 }
 
-int MEMPHY_remove_usedfp(struct memphy_struct *mp, int fpn){
-   struct framephy_struct *fp = mp->used_fp_list;
-   if (!fp) return -1;
-   if (fp->fpn == fpn) {
-      mp->used_fp_list = mp->used_fp_list->fp_next;
-      fp->fp_next = NULL;
-      return 0;
+/*
+ *  Used frame list
+ *  used_fp_list is an intrusive doubly linked FIFO threaded through the
+ *  frame table: frames are appended at the tail when mapped and the
+ *  oldest one is taken from the head for global eviction. Insert, remove
+ *  and lookup are all O(1).
+ *  A private frame is also on the FIFO of its owner (mm->fifo_head), in
+ *  the same order, so a frame leaving RAM by any path leaves both. The
+ *  FIFO changes under the device lock with the owner held or claimed,
+ *  find_victim_page reads it holding the owner only.
+ */
+static void __MEMPHY_unlink_usedfp(struct memphy_struct *mp, struct framephy_struct *fp)
+{
+   struct mm_struct *mm = fp->owner;
+
+   if (mm != NULL) {
+      if (fp->fifo_prev)
+        fp->fifo_prev->fifo_next = fp->fifo_next;
+      else
+        mm->fifo_head = fp->fifo_next;
+
+      if (fp->fifo_next)
+        fp->fifo_next->fifo_prev = fp->fifo_prev;
+      else
+        mm->fifo_tail = fp->fifo_prev;
+
+      fp->fifo_next = fp->fifo_prev = NULL;
    }
-   else {
-      while (fp->fp_next) {
-         if (fp->fp_next->fpn == fpn) {
-            struct framephy_struct *ret = fp->fp_next;
-            fp->fp_next = fp->fp_next->fp_next;
-            ret->fp_next = NULL;
-            return 0;
-         }
-         else fp = fp->fp_next;
-      }
-      return -1;
+
+   if (fp->fp_prev)
+     fp->fp_prev->fp_next = fp->fp_next;
+   else
+     mp->used_fp_list = fp->fp_next;
+
+   if (fp->fp_next)
+     fp->fp_next->fp_prev = fp->fp_prev;
+   else
+     mp->used_fp_tail = fp->fp_prev;
+
+   fp->fp_next = fp->fp_prev = NULL;
+   fp->flags &= ~FRAME_USED;
+   fp->ksm_seq = -1;
+}
+
+int MEMPHY_remove_usedfp(struct memphy_struct *mp, int fpn)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(mp, fpn);
+   int ret = -1;
+
+   if (fp == NULL)
+     return -1;
+
+   pthread_mutex_lock(&mp->lock);
+   if (fp->flags & FRAME_USED) {
+      __MEMPHY_unlink_usedfp(mp, fp);
+      ret = 0;
    }
+   pthread_mutex_unlock(&mp->lock);
+
+   return ret;
 }
 
-int MEMPHY_put_usedfp(struct memphy_struct *mp, int fpn, struct mm_struct *owner)
+int MEMPHY_put_usedfp(struct memphy_struct *mp, int fpn, struct mm_struct *owner, int pgn)
 {
-   struct framephy_struct *fp = mp->used_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   struct framephy_struct *fp = MEMPHY_get_frame(mp, fpn);
+
+   if (fp == NULL)
+     return -1;
+
+   pthread_mutex_lock(&mp->lock);
+   if (fp->flags & FRAME_USED)
+     __MEMPHY_unlink_usedfp(mp, fp);
+
+   fp->owner = owner;
+   fp->pgn = pgn;
+   fp->flags = (fp->flags & ~FRAME_FREE) | FRAME_USED;
 
-   /* Create new node with value fpn */
-   newnode->fpn = fpn;
-   newnode->owner = owner;
-   newnode->fp_next = NULL;
    /* Push new frame to the end of the list*/
-   if (!fp) {
-      mp->used_fp_list = newnode;
-   }
-   else {
-      while (fp->fp_next) {
-         fp = fp->fp_next;
-      } 
-      fp->fp_next = newnode;
+   fp->fp_next = NULL;
+   fp->fp_prev = mp->used_fp_tail;
+   if (mp->used_fp_tail)
+     mp->used_fp_tail->fp_next = fp;
+   else
+     mp->used_fp_list = fp;
+   mp->used_fp_tail = fp;
+
+   if (owner != NULL) {
+      fp->fifo_next = NULL;
+      fp->fifo_prev = owner->fifo_tail;
+      if (owner->fifo_tail)
+        owner->fifo_tail->fifo_next = fp;
+      else
+        owner->fifo_head = fp;
+      owner->fifo_tail = fp;
    }
+   pthread_mutex_unlock(&mp->lock);
+
    return 0;
 }
 
-struct framephy_struct* MEMPHY_get_usedfp(struct memphy_struct *mp)
+/*
+ *  MEMPHY_get_usedfp - detach the oldest used frame whose owner is free
+ *  @mp: memphy struct
+ *  @self: mm the caller already holds, NULL for none
+ *  @memcg: only take a private frame of this group, NULL for any frame
+ *
+ *  The owner of the returned frame is claimed (mm_claim), the caller
+ *  releases it with mm_unclaim once the PTE is updated. A shared frame
+ *  comes with its segment claimed instead (shm_claim). Frames of an mm
+ *  or segment busy on another CPU are passed over, so are those of a
+ *  group with no swap left (memcg_evictable).
+ *  The returned entry lives in the frame table, it must not be freed.
+ */
+struct framephy_struct* MEMPHY_get_usedfp(struct memphy_struct *mp, struct mm_struct *self,
+                                          struct mm_memcg *memcg)
 {
-   struct framephy_struct *fp = mp->used_fp_list;
-
-   if (fp == NULL)
-     return NULL;
-   mp->used_fp_list = fp->fp_next;
+   struct framephy_struct *fp;
+
+   pthread_mutex_lock(&mp->lock);
+   for (fp = mp->used_fp_list; fp != NULL; fp = fp->fp_next)
+     if (memcg_evictable(fp, memcg) &&
+         ((fp->flags & FRAME_SHM) ? shm_claim(fp->pgn) == 0 :
+                                    mm_claim(fp->owner, self) == 0))
+     {
+       __MEMPHY_unlink_usedfp(mp, fp);
+       break;
+     }
+   pthread_mutex_unlock(&mp->lock);
 
-   /* MEMPHY is iteratively used up until its exhausted
-    * No garbage collector acting then it not been released
-    */
    return fp;
 }
 
 /*
  *  Init MEMPHY struct
  */
-int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
+static int __init_memphy(struct memphy_struct *mp, int max_size, int randomflg, BYTE *storage)
 {
-   mp->storage = (BYTE *)malloc(max_size*sizeof(BYTE));
+   mp->storage = storage;
    mp->maxsz = max_size;
-   mp->used_fp_list = NULL;
+   mp->filemap = 0;
+   mp->filefd = -1;
+   pthread_mutex_init(&mp->lock, NULL);
+   mp->pcp = NULL;
+   mp->npcp = 0;
+   mp->pcp_batch = 0;
+   mp->swp_map = NULL;
+   mp->swp_cnt = NULL;
+   mp->swp_owner = NULL;
+   mp->swp_pgn = NULL;
+   mp->swp_lnext = mp->swp_lprev = NULL;
+   mp->swp_nr = mp->swp_free = mp->swp_hint = 0;
    MEMPHY_format(mp,PAGING_PAGESZ);
 
    mp->rdmflg = (randomflg != 0)?1:0;
+   mp->csr_steps = 0;
+   mp->lat = 0;
+   mp->io_cost = 0;
 
    if (!mp->rdmflg )   /* Not Ramdom acess device, then it serial device*/
       mp->cursor = 0;
@@ -256,4 +713,311 @@ int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
    return 0;
 }
 
+int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
+{
+   return __init_memphy(mp, max_size, randomflg, (BYTE *)MEMPHY_reserve(max_size*sizeof(BYTE)));
+}
+
+/*
+ * State of a persistent device, kept in its host file right after the
+ * device bytes: this header, the free list FPNs in list order, then the
+ * references of every swap slot if the device was used as swap
+ */
+#define MEMPHY_FILE_MAGIC 0x4d504859 /* "MPHY" */
+
+struct memphy_filehdr {
+   unsigned int magic;
+   int pagesz;
+   int maxsz;
+   int fresh_fpn;   /* frames handed out so far, backed in the file */
+   int nr_free;     /* FPNs that follow */
+   int swp_nr;      /* slot counts that follow, 0: never used as swap */
+   int swp_hint;
+};
+
+/*
+ *  MEMPHY_read_state - read the state a persistent device file kept
+ *  @fd: host file
+ *  @max_size: device size
+ *  @hdr: header read
+ *  @order: free list read, freed by the caller
+ *  @cnt: slot references read, NULL if none, freed by the caller
+ *
+ *  Fails on a file without a state matching this device and paging
+ *  geometry.
+ */
+static int MEMPHY_read_state(int fd, int max_size, struct memphy_filehdr *hdr,
+                             int **order, unsigned short **cnt)
+{
+   off_t off = max_size;
+   size_t len;
+   int i;
+
+   *order = NULL;
+   *cnt = NULL;
+   if (pread(fd, hdr, sizeof(*hdr), off) != (ssize_t)sizeof(*hdr) ||
+       hdr->magic != MEMPHY_FILE_MAGIC || hdr->pagesz != PAGING_PAGESZ ||
+       hdr->maxsz != max_size || hdr->fresh_fpn < 0 ||
+       hdr->fresh_fpn > max_size / PAGING_PAGESZ ||
+       hdr->nr_free < 0 || hdr->nr_free > hdr->fresh_fpn ||
+       (hdr->swp_nr != 0 && hdr->swp_nr != max_size / PAGING_PAGESZ))
+     return -1;
+   off += sizeof(*hdr);
+
+   len = hdr->nr_free * sizeof(int);
+   *order = malloc(len ? len : 1);
+   if (*order == NULL || pread(fd, *order, len, off) != (ssize_t)len)
+     return -1;
+   off += len;
+
+   for (i = 0; i < hdr->nr_free; i++)
+     if ((*order)[i] < 0 || (*order)[i] >= hdr->fresh_fpn)
+       return -1;
+
+   if (hdr->swp_nr > 0)
+   {
+     len = hdr->swp_nr * sizeof(unsigned short);
+     *cnt = malloc(len);
+     if (*cnt == NULL || pread(fd, *cnt, len, off) != (ssize_t)len)
+       return -1;
+   }
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_load_state - take back the frame table and slot map read by
+ *  MEMPHY_read_state, on a device just set up
+ *
+ *  Frames handed out before are all free again, nothing of this run maps
+ *  them: the saved free list comes first, then the frames that were in
+ *  use or cached per CPU, in ascending order. fresh_fpn carries on from
+ *  the file, so the frames it backs are reused before any new one.
+ */
+static int MEMPHY_load_state(struct memphy_struct *mp, struct memphy_filehdr *hdr,
+                             int *order, unsigned short *cnt)
+{
+   BYTE *listed;
+   int i, fpn;
+
+   listed = calloc(hdr->fresh_fpn ? hdr->fresh_fpn : 1, 1);
+   if (listed == NULL)
+     return -1;
+
+   for (i = 0; i < hdr->nr_free; i++)
+   {
+     if (listed[order[i]])
+     {
+       free(listed);
+       return -1;
+     }
+     listed[order[i]] = 1;
+   }
+
+   if (cnt != NULL && MEMPHY_load_swpmap(mp, cnt, hdr->swp_hint) < 0)
+   {
+     free(listed);
+     return -1;
+   }
+
+   /* Pushed in reverse, the list pops in the order above */
+   mp->fresh_fpn = hdr->fresh_fpn;
+   mp->nr_free = mp->maxfpn - mp->fresh_fpn;
+   for (fpn = mp->fresh_fpn - 1; fpn >= 0; fpn--)
+   {
+     mp->frmtbl[fpn].fpn = fpn;
+     mp->frmtbl[fpn].swptyp = 0;
+     MEMPHY_frame_reset(mp, fpn, FRAME_FREE);
+     if (!listed[fpn])
+       __MEMPHY_put_freefp(mp, fpn);
+   }
+   for (i = hdr->nr_free - 1; i >= 0; i--)
+     __MEMPHY_put_freefp(mp, order[i]);
+
+   free(listed);
+   return 0;
+}
+
+/*
+ *  MEMPHY_save_state - write the frame table and slot map of a persistent
+ *  device after its bytes, for the next run to take back
+ *  @mp: memphy struct, no longer used
+ *
+ *  The header goes last, a file cut short on the way has no state.
+ */
+static int MEMPHY_save_state(struct memphy_struct *mp)
+{
+   struct memphy_filehdr hdr = {
+      .magic = MEMPHY_FILE_MAGIC,
+      .pagesz = PAGING_PAGESZ,
+      .maxsz = mp->maxsz,
+      .fresh_fpn = mp->fresh_fpn,
+      .swp_nr = mp->swp_nr,
+      .swp_hint = mp->swp_hint,
+   };
+   struct framephy_struct *fp;
+   off_t off = mp->maxsz + sizeof(hdr);
+   size_t len;
+   int *order;
+   int ret = -1;
+
+   order = malloc((mp->maxfpn ? mp->maxfpn : 1) * sizeof(int));
+   if (order == NULL)
+     return -1;
+   for (fp = mp->free_fp_list; fp != NULL && hdr.nr_free < mp->maxfpn; fp = fp->fp_next)
+     order[hdr.nr_free++] = fp->fpn;
+
+   len = hdr.nr_free * sizeof(int);
+   if (pwrite(mp->filefd, order, len, off) == (ssize_t)len &&
+       (hdr.swp_nr == 0 ||
+        pwrite(mp->filefd, mp->swp_cnt, hdr.swp_nr * sizeof(unsigned short), off + len) ==
+        (ssize_t)(hdr.swp_nr * sizeof(unsigned short))) &&
+       pwrite(mp->filefd, &hdr, sizeof(hdr), mp->maxsz) == (ssize_t)sizeof(hdr))
+     ret = 0;
+
+   free(order);
+   return ret;
+}
+
+/*
+ *  init_memphy_file - initialize a MEMPHY device backed by a host file
+ *  @mp: memphy struct
+ *  @max_size: device size
+ *  @randomflg: random access device
+ *  @path: host file, created and sized to the device
+ *  @persist: keep the file and the device state across runs
+ *
+ *  The file is sparse and mapped shared, host pages are populated only
+ *  when the device touches them and can be written back by the host
+ *  instead of being held in its RAM. Without persist it starts empty,
+ *  like any device, and is unlinked once mapped. A persistent file keeps
+ *  its bytes and takes back the state MEMPHY_destroy saved in it; one
+ *  with no valid state starts empty. The state is dropped from the file
+ *  once read, so a run that never gets to MEMPHY_destroy leaves none.
+ */
+int init_memphy_file(struct memphy_struct *mp, int max_size, int randomflg,
+                     const char *path, int persist)
+{
+   struct memphy_filehdr hdr;
+   unsigned short *cnt = NULL;
+   int *order = NULL;
+   BYTE *storage;
+   int fd, kept = 0;
+
+   if (max_size <= 0)
+     return -1;
+
+   fd = open(path, O_RDWR | O_CREAT | (persist ? 0 : O_TRUNC), 0600);
+   if (fd < 0)
+     return -1;
+
+   if (persist)
+     kept = (MEMPHY_read_state(fd, max_size, &hdr, &order, &cnt) == 0);
+
+   if ((!kept && ftruncate(fd, 0) < 0) || ftruncate(fd, max_size) < 0 ||
+       (storage = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+   {
+     free(order);
+     free(cnt);
+     close(fd);
+     return -1;
+   }
+
+   __init_memphy(mp, max_size, randomflg, storage);
+   mp->filemap = 1;
+   if (kept && MEMPHY_load_state(mp, &hdr, order, cnt) < 0)
+   {
+     MEMPHY_destroy(mp);
+     free(order);
+     free(cnt);
+     close(fd);
+     return -1;
+   }
+   free(order);
+   free(cnt);
+
+   /* Otherwise the mapping holds the file from here on */
+   if (persist)
+     mp->filefd = fd;
+   else {
+     close(fd);
+     unlink(path);
+   }
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_init_pcp - enable per-CPU free frame caches on a device
+ *  @mp: memphy struct
+ *  @ncpus: number of CPU threads that allocate from the device
+ *
+ *  A cache holds up to two batches, past that one batch goes back to the
+ *  device list. The batch is capped so all caches together hold at most
+ *  the device, one CPU no more than its share of it; tiny RAM configs end
+ *  up with caching disabled.
+ */
+int MEMPHY_init_pcp(struct memphy_struct *mp, int ncpus)
+{
+   int numfp = mp->maxsz / PAGING_PAGESZ;
+   int batch = MEMPHY_PCP_BATCH;
+   int cpu;
+
+   if (ncpus <= 0)
+     return -1;
+
+   if (batch > numfp / (2 * ncpus))
+     batch = numfp / (2 * ncpus);
+   if (batch <= 0)
+     return 0; /* Too few frames to be worth caching */
+
+   mp->pcp = malloc(ncpus * sizeof(struct memphy_pcp));
+   for (cpu = 0; cpu < ncpus; cpu++)
+   {
+     pthread_mutex_init(&mp->pcp[cpu].lock, NULL);
+     mp->pcp[cpu].count = 0;
+   }
+   mp->npcp = ncpus;
+   mp->pcp_batch = batch;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_destroy - give back the storage and tables of a device, once
+ *  nothing uses it any more; a persistent file gets the device state
+ *  first
+ *  @mp: memphy struct
+ */
+int MEMPHY_destroy(struct memphy_struct *mp)
+{
+   int cpu;
+
+   if (mp->filefd >= 0)
+   {
+     MEMPHY_save_state(mp);
+     close(mp->filefd);
+     mp->filefd = -1;
+   }
+   if (mp->filemap)
+     munmap(mp->storage, mp->maxsz);
+   else
+     MEMPHY_unreserve(mp->storage, mp->maxsz);
+   MEMPHY_unreserve(mp->frmtbl, mp->maxfpn * sizeof(struct framephy_struct));
+   MEMPHY_free_swpmap(mp);
+
+   for (cpu = 0; cpu < mp->npcp; cpu++)
+     pthread_mutex_destroy(&mp->pcp[cpu].lock);
+   free(mp->pcp);
+   pthread_mutex_destroy(&mp->lock);
+
+   mp->storage = NULL;
+   mp->frmtbl = NULL;
+   mp->pcp = NULL;
+   mp->npcp = 0;
+   mp->maxfpn = 0;
+
+   return 0;
+}
+
 #endif
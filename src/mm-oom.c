@@ -0,0 +1,240 @@
+/*
+ * PAGING based Memory Management
+ * Out of memory handling mm/mm-oom.c
+ *
+ * A frame request fails for good once MEMRAM has no free frame and no
+ * victim can be swapped out, every swap device (and the compressed
+ * cache) being full. What happens then is the OOM policy: the request
+ * fails, or a victim process is killed and the request retried. The
+ * victim is the live process holding the most private pages in RAM, or
+ * the one of lowest priority, biggest first. Its pages in swap count too
+ * once swap is full, otherwise freeing them gains no frame.
+ *
+ * The victim is reaped on the spot by the process that ran out of
+ * memory: its frames and swap slots are given back and its mm is marked
+ * killed, so it fails every later access and its CPU retires it at the
+ * next dispatch check. A process busy in its own fault is not picked.
+ * A caller stuck at its resident limit (mm-memcg.c) only kills within
+ * its own group.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+static struct {
+   int policy;
+
+   /* Live processes, victim candidates */
+   struct pcb_t **proc;
+   int nr, cap;
+
+   unsigned long kills, failures;
+   pthread_mutex_t lock;
+} oom = { .policy = OOM_POLICY_FAIL, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ *  oom_set_policy - select what an exhausted frame request does
+ *  @name: "FAIL" fail the request, "LARGEST" kill the biggest process or
+ *  "PRIO" kill the lowest priority process
+ */
+int oom_set_policy(const char *name)
+{
+   if (strcmp(name, "FAIL") == 0)
+     oom.policy = OOM_POLICY_FAIL;
+   else if (strcmp(name, "LARGEST") == 0)
+     oom.policy = OOM_POLICY_LARGEST;
+   else if (strcmp(name, "PRIO") == 0)
+     oom.policy = OOM_POLICY_PRIO;
+   else
+     return -1;
+
+   return 0;
+}
+
+/*
+ *  oom_register - make a loaded process a victim candidate
+ */
+int oom_register(struct pcb_t *proc)
+{
+   struct pcb_t **p;
+
+   pthread_mutex_lock(&oom.lock);
+   if (oom.nr == oom.cap)
+   {
+     p = realloc(oom.proc, (oom.cap ? 2 * oom.cap : 16) * sizeof(*p));
+     if (p == NULL)
+     {
+       pthread_mutex_unlock(&oom.lock);
+       return -1;
+     }
+     oom.proc = p;
+     oom.cap = oom.cap ? 2 * oom.cap : 16;
+   }
+   oom.proc[oom.nr++] = proc;
+   pthread_mutex_unlock(&oom.lock);
+
+   return 0;
+}
+
+/*
+ *  oom_unregister - withdraw a process before its mm goes away
+ */
+int oom_unregister(struct pcb_t *proc)
+{
+   int i;
+
+   pthread_mutex_lock(&oom.lock);
+   for (i = 0; i < oom.nr; i++)
+     if (oom.proc[i] == proc)
+     {
+       oom.proc[i] = oom.proc[--oom.nr];
+       break;
+     }
+   pthread_mutex_unlock(&oom.lock);
+
+   return 0;
+}
+
+/*
+ *  oom_killed - the mm was reaped by the OOM killer
+ */
+int oom_killed(struct mm_struct *mm)
+{
+   return mm != NULL && __atomic_load_n(&mm->oom_killed, __ATOMIC_ACQUIRE);
+}
+
+static int oom_prio(struct pcb_t *proc)
+{
+#ifdef MLQ_SCHED
+   return proc->prio;
+#else
+   return proc->priority;
+#endif
+}
+
+/*
+ *  oom_badness - private pages of an mm, online and swapped, mm held;
+ *  merged pages stay with the other sharers like segment pages do
+ */
+static void oom_badness(struct mm_struct *mm, int *nram, int *nswp)
+{
+   struct vm_area_struct *vma;
+   int pgn, end;
+   pte_t pte;
+
+   *nram = *nswp = 0;
+   for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+   {
+     end = PAGING_PGN(PAGING_PAGE_ALIGNSZ(vma->vm_end));
+     for (pgn = PAGING_PGN(vma->vm_start); pgn < end; pgn++)
+     {
+       pte = mm->pgd[pgn];
+       /* Segment pages stay with the other sharers */
+       if (!PAGING_PAGE_PRESENT(pte) ||
+           (pte & (PAGING_PTE_SHARED_MASK | PAGING_PTE_COW_MASK)))
+         continue;
+       if (PAGING_PAGE_SWAPPED(pte))
+         (*nswp)++;
+       else
+         (*nram)++;
+     }
+   }
+}
+
+/*
+ *  oom_worse - @a is a better victim than @b under the policy
+ */
+static int oom_worse(struct pcb_t *a, int pages_a, struct pcb_t *b, int pages_b)
+{
+   if (oom.policy == OOM_POLICY_PRIO && oom_prio(a) != oom_prio(b))
+     return oom_prio(a) > oom_prio(b);
+   return pages_a > pages_b;
+}
+
+/*
+ *  oom_kill - reclaim the memory of a victim process, called by a frame
+ *  request that found neither a free frame nor a page to swap out, the
+ *  caller holds its own mm lock and nothing else
+ *  @caller: caller
+ *
+ *  Return 0 if the request may be retried, -1 if it fails: the policy is
+ *  FAIL, no process can be reclaimed, or the caller was the victim.
+ */
+int oom_kill(struct pcb_t *caller)
+{
+   struct pcb_t *victim = NULL, *p;
+   struct mm_memcg *memcg = NULL;
+   int i, nram, nswp, pages, best = 0, vram = 0, vswp = 0, self, swpfull;
+
+   if (memcg_room(caller->mm, MEMCG_RSS) <= 0)
+     memcg = caller->mm->memcg;
+
+   /* Swapped pages only help when eviction stalled on a full swap */
+   swpfull = (swap_nr_free(caller) == 0);
+
+   pthread_mutex_lock(&oom.lock);
+   if (oom.policy == OOM_POLICY_FAIL)
+   {
+     oom.failures++;
+     pthread_mutex_unlock(&oom.lock);
+     return -1;
+   }
+
+   /* The best candidate so far stays claimed */
+   for (i = 0; i < oom.nr; i++)
+   {
+     p = oom.proc[i];
+     if ((memcg != NULL && p->mm->memcg != memcg) ||
+         oom_killed(p->mm) || mm_claim(p->mm, caller->mm) < 0)
+       continue;
+
+     oom_badness(p->mm, &nram, &nswp);
+     pages = nram + (swpfull ? nswp : 0);
+     if (pages > 0 && (victim == NULL || oom_worse(p, pages, victim, best)))
+     {
+       if (victim != NULL)
+         mm_unclaim(victim->mm, caller->mm);
+       victim = p;
+       best = pages;
+       vram = nram;
+       vswp = nswp;
+     } else {
+       mm_unclaim(p->mm, caller->mm);
+     }
+   }
+
+   if (victim == NULL)
+   {
+     oom.failures++;
+     pthread_mutex_unlock(&oom.lock);
+     return -1;
+   }
+
+   release_mm_pages(victim);
+   __atomic_store_n(&victim->mm->oom_killed, 1, __ATOMIC_RELEASE);
+   mm_unclaim(victim->mm, caller->mm);
+   oom.kills++;
+   self = (victim == caller);
+
+   /* Still registered, the victim can not be retired under us */
+   printf("OOM: killed process %d (prio %d), %d pages in RAM and %d in swap reclaimed\n",
+          victim->pid, oom_prio(victim), vram, vswp);
+   pthread_mutex_unlock(&oom.lock);
+
+   return self ? -1 : 0;
+}
+
+/*
+ *  oom_dump - print the OOM events, if any
+ */
+int oom_dump(void)
+{
+   if (oom.kills + oom.failures > 0)
+     printf("oom: %lu processes killed, %lu requests failed\n",
+            oom.kills, oom.failures);
+
+   return 0;
+}
@@ -0,0 +1,425 @@
+/*
+ * PAGING based Memory Management
+ * Shared memory segments mm/mm-shm.c
+ *
+ * A segment is a run of pages shared by every process attaching it. The
+ * segment holds the state of its pages in PTE format (not present until
+ * first touched, online in a frame, or swapped) and the list of its
+ * attachments, which is the reverse map of all its pages.
+ *
+ * An attached page is mapped lazily: the PTE of an attaching process
+ * is marked PAGING_PTE_SHARED_MASK and left swapped with SWPTYP
+ * PAGING_SWPTYP_SHM until the process touches the page, then it maps
+ * the segment's frame and the frame's refcount counts it. A shared
+ * frame is evicted as a whole: every attached PTE is turned back to the
+ * SHM encoding at once, so no sharer is left mapping a frame that was
+ * reused.
+ *
+ * Segments live until the simulation ends, like SysV segments never
+ * marked for removal.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+struct shm_segment {
+   int key;
+   int npages;
+   pte_t *pte;                  /* page states */
+   struct shm_attach *attach;   /* reverse map */
+   int nattach;
+
+   /* Devices the pages live on */
+   struct memphy_struct *mram;
+   struct memphy_struct **mswp;
+
+   pthread_mutex_t lock;
+};
+
+static struct {
+   struct shm_segment seg[SHM_MAX_SEG];
+   int nseg;
+   pthread_mutex_t lock;        /* creation and lookup by key */
+} shm_tbl = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ *  shm_lookup - segment ID of a key, -1 if there is none
+ */
+static int shm_lookup(int key)
+{
+   int id;
+
+   pthread_mutex_lock(&shm_tbl.lock);
+   for (id = 0; id < shm_tbl.nseg && shm_tbl.seg[id].key != key; id++);
+   if (id == shm_tbl.nseg)
+     id = -1;
+   pthread_mutex_unlock(&shm_tbl.lock);
+
+   return id;
+}
+
+/*
+ *  pgshmget - create the shared memory segment of a key
+ *  @proc: process executing the instruction
+ *  @key: segment key
+ *  @size: segment size, rounded up to whole pages
+ *
+ *  An existing segment of the key is kept as it is
+ */
+int pgshmget(struct pcb_t *proc, uint32_t key, uint32_t size)
+{
+   struct shm_segment *seg;
+   int id, npages = PAGING_PAGE_ALIGNSZ(size) / PAGING_PAGESZ;
+
+   if (npages <= 0 || npages > BIT(SHM_IDX_BITS))
+     return -1;
+
+   pthread_mutex_lock(&shm_tbl.lock);
+   for (id = 0; id < shm_tbl.nseg && shm_tbl.seg[id].key != key; id++);
+   if (id == shm_tbl.nseg)
+   {
+     seg = &shm_tbl.seg[id];
+     if (id == SHM_MAX_SEG || (seg->pte = calloc(npages, sizeof(pte_t))) == NULL)
+     {
+       pthread_mutex_unlock(&shm_tbl.lock);
+       return -1;
+     }
+     seg->key = key;
+     seg->npages = npages;
+     seg->attach = NULL;
+     seg->nattach = 0;
+     seg->mram = proc->mram;
+     seg->mswp = proc->mswp;
+     pthread_mutex_init(&seg->lock, NULL);
+     shm_tbl.nseg++;
+   }
+   pthread_mutex_unlock(&shm_tbl.lock);
+
+   printf("Shared segment for Process %d - key %u, %d pages\n",
+          proc->pid, key, shm_tbl.seg[id].npages);
+   return 0;
+}
+
+/*
+ *  pgshmat - attach a shared memory segment as a region
+ *  @proc: process executing the instruction
+ *  @key: segment key
+ *  @reg_index: region ID of the attachment, not in use
+ *  @vmaid: vm area the segment is placed in, at its break
+ */
+int pgshmat(struct pcb_t *proc, uint32_t key, uint32_t reg_index, uint32_t vmaid)
+{
+   struct mm_struct *mm = proc->mm;
+   struct vm_area_struct *vma;
+   struct vm_rg_struct *rg;
+   struct shm_segment *seg;
+   struct shm_attach *a;
+   int id = shm_lookup(key);
+   int pgn, idx;
+
+   if (id < 0)
+     return -1;
+   seg = &shm_tbl.seg[id];
+
+   pthread_mutex_lock(&mm->lock);
+   if ((vma = get_vma_by_num(mm, vmaid)) == NULL && !mm->oom_killed)
+     vma = vma_create(mm, vmaid);
+   if (vma == NULL || mm->oom_killed || vm_symtbl_lookup(&mm->symrgtbl, reg_index) != NULL ||
+       (a = mm_arena_alloc(mm->arena, &shm_attach_cache)) == NULL)
+   {
+     pthread_mutex_unlock(&mm->lock);
+     return -1;
+   }
+
+   /* The region entry first, nothing is mapped yet if the table is full */
+   if ((rg = vm_symtbl_insert(&mm->symrgtbl, reg_index)) == NULL)
+   {
+     mm_arena_free(mm->arena, &shm_attach_cache, a);
+     pthread_mutex_unlock(&mm->lock);
+     return -1;
+   }
+
+   /* The break is page aligned, the segment takes whole pages above it */
+   pgn = PAGING_PGN(vma->sbrk);
+   if (vma_grow(proc, vmaid, seg->npages * PAGING_PAGESZ) < 0)
+   {
+     vm_symtbl_remove(&mm->symrgtbl, reg_index);
+     mm_arena_free(mm->arena, &shm_attach_cache, a);
+     pthread_mutex_unlock(&mm->lock);
+     return -1;
+   }
+
+   for (idx = 0; idx < seg->npages; idx++)
+   {
+     mm->pgd[pgn + idx] = PAGING_PTE_SHARED_MASK;
+     pte_set_swap(&mm->pgd[pgn + idx], PAGING_SWPTYP_SHM, SHM_OFF(id, idx));
+   }
+
+   a->mm = mm;
+   a->pgn = pgn;
+   pthread_mutex_lock(&seg->lock);
+   a->next = seg->attach;
+   seg->attach = a;
+   seg->nattach++;
+   pthread_mutex_unlock(&seg->lock);
+
+   rg->rg_start = (addr_t)pgn << PAGING_PAGE_SHIFT;
+   rg->rg_end = (addr_t)(pgn + seg->npages) << PAGING_PAGE_SHIFT;
+   rg->vmaid = vmaid;
+   rg->shmid = id;
+
+   printf("Attach for Process %d - key %u at [%lu -%lu]\n",
+          proc->pid, key, (unsigned long)rg->rg_start, (unsigned long)rg->rg_end);
+   print_pgtbl(proc, 0, -1);
+   pthread_mutex_unlock(&mm->lock);
+
+   return 0;
+}
+
+/*
+ *  pgshmdt - detach the shared memory segment attached as a region
+ *  @proc: process executing the instruction
+ *  @reg_index: region ID of the attachment
+ */
+int pgshmdt(struct pcb_t *proc, uint32_t reg_index)
+{
+   struct vm_rg_struct *rg;
+   int vmaid = -1;
+
+   pthread_mutex_lock(&proc->mm->lock);
+   rg = vm_symtbl_lookup(&proc->mm->symrgtbl, reg_index);
+   if (rg != NULL && rg->shmid >= 0)
+     vmaid = rg->vmaid;
+   pthread_mutex_unlock(&proc->mm->lock);
+
+   /* Freeing an attached region detaches it */
+   return (vmaid < 0) ? -1 : __free(proc, vmaid, reg_index);
+}
+
+/*
+ *  shm_detach - drop an attachment, caller holds its mm lock
+ *  @caller: attaching process
+ *  @rg: region of the attachment
+ */
+int shm_detach(struct pcb_t *caller, struct vm_rg_struct *rg)
+{
+   struct mm_struct *mm = caller->mm;
+   struct shm_segment *seg = &shm_tbl.seg[rg->shmid];
+   struct shm_attach **pa, *a;
+   int pgn = PAGING_PGN(rg->rg_start), idx;
+   pte_t *pte;
+
+   pthread_mutex_lock(&seg->lock);
+   for (pa = &seg->attach; *pa != NULL; pa = &(*pa)->next)
+     if ((*pa)->mm == mm && (*pa)->pgn == pgn)
+       break;
+   if ((a = *pa) == NULL)
+   {
+     pthread_mutex_unlock(&seg->lock);
+     return -1;
+   }
+   *pa = a->next;
+   seg->nattach--;
+
+   for (idx = 0; idx < seg->npages; idx++)
+   {
+     pte = &mm->pgd[pgn + idx];
+     if (!PAGING_PAGE_SWAPPED(*pte))
+       MEMPHY_get_frame(seg->mram, PAGING_PTE_FPN(*pte))->refcount--;
+     *pte = 0;
+   }
+   pthread_mutex_unlock(&seg->lock);
+
+   mm_arena_free(mm->arena, &shm_attach_cache, a);
+   rg->shmid = -1;
+   return 0;
+}
+
+/*
+ *  shm_getpage - map a shared page on its first touch by a process,
+ *  caller holds the mm lock
+ *  @caller: caller
+ *  @mm: mm of the faulting PTE, PAGING_SWPTYP_SHM encoded
+ *  @pgn: page number
+ *  @fpn: frame of the page
+ *
+ *  Return 1 if a frame was taken for the page, 0 if another sharer had
+ *  it online already, -1 on failure
+ */
+int shm_getpage(struct pcb_t *caller, struct mm_struct *mm, int pgn, int *fpn)
+{
+   int off = PAGING_SWP(mm->pgd[pgn]), fault = 0;
+   struct shm_segment *seg = &shm_tbl.seg[SHM_OFF_ID(off)];
+   pte_t *spte = &seg->pte[SHM_OFF_IDX(off)];
+   struct framephy_struct *fp;
+
+   pthread_mutex_lock(&seg->lock);
+   if (PAGING_PAGE_PRESENT(*spte) && !PAGING_PAGE_SWAPPED(*spte))
+     *fpn = PAGING_PTE_FPN(*spte);
+   else {
+     /* The segment page is out, bring it in for every sharer. Frames of
+      * this segment can not be taken to make room while we hold it */
+     if (alloc_frame(caller, fpn) < 0)
+     {
+       pthread_mutex_unlock(&seg->lock);
+       return -1;
+     }
+     if (!PAGING_PAGE_PRESENT(*spte))
+       MEMPHY_zero_frame(caller->mram, *fpn);
+     else if (swap_in_page(caller, *spte, *fpn) < 0)
+     {
+       MEMPHY_put_freefp(caller->mram, *fpn);
+       pthread_mutex_unlock(&seg->lock);
+       return -1;
+     }
+     pte_set_fpn(spte, *fpn);
+
+     fp = MEMPHY_get_frame(caller->mram, *fpn);
+     fp->flags |= FRAME_SHM;
+     fp->refcount = 0;
+     MEMPHY_put_usedfp(caller->mram, *fpn, NULL, off);
+     fault = 1;
+   }
+
+   MEMPHY_get_frame(caller->mram, *fpn)->refcount++;
+   pte_set_fpn(&mm->pgd[pgn], *fpn);
+   pthread_mutex_unlock(&seg->lock);
+
+   return fault;
+}
+
+/*
+ *  shm_drop_copy - release the swap copy of a shared frame on the first
+ *  write through one of its PTEs
+ *  @caller: caller, mapping the frame
+ *  @fpn: shared frame
+ */
+int shm_drop_copy(struct pcb_t *caller, int fpn)
+{
+   /* Mapped by the caller, the frame stays with its segment meanwhile */
+   int off = MEMPHY_get_frame(caller->mram, fpn)->pgn;
+   struct shm_segment *seg = &shm_tbl.seg[SHM_OFF_ID(off)];
+   int ret;
+
+   pthread_mutex_lock(&seg->lock);
+   ret = swap_drop_copy(caller, fpn);
+   pthread_mutex_unlock(&seg->lock);
+
+   return ret;
+}
+
+/*
+ *  shm_claim - trylock the segment of a shared frame, called under the
+ *  device lock while scanning the used list
+ *  @off: SHM_OFF of the frame
+ */
+int shm_claim(int off)
+{
+   return pthread_mutex_trylock(&shm_tbl.seg[SHM_OFF_ID(off)].lock) == 0 ? 0 : -1;
+}
+
+/*
+ *  shm_claim_mm - claim the mm of an attachment, once per mm
+ */
+static int shm_claim_mm(struct shm_segment *seg, struct shm_attach *a,
+                        struct mm_struct *self, int claim)
+{
+   struct shm_attach *b;
+
+   /* One mm may attach the segment more than once */
+   for (b = seg->attach; b != a; b = b->next)
+     if (b->mm == a->mm)
+       return 0;
+
+   if (!claim)
+   {
+     mm_unclaim(a->mm, self);
+     return 0;
+   }
+   return mm_claim(a->mm, self);
+}
+
+/*
+ *  shm_swap_out - evict a shared frame from all its sharers
+ *  @caller: caller
+ *  @fp: frame taken off the used list, its segment claimed by shm_claim
+ *
+ *  The segment is released here. On success the frame is left to the
+ *  caller, otherwise it goes back on the used list.
+ */
+int shm_swap_out(struct pcb_t *caller, struct framephy_struct *fp)
+{
+   struct shm_segment *seg = &shm_tbl.seg[SHM_OFF_ID(fp->pgn)];
+   int idx = SHM_OFF_IDX(fp->pgn);
+   struct shm_attach *a, *b;
+   int swptyp, swpoff, ret = -1;
+   pte_t *pte;
+
+   /* All sharers or none, a PTE must not outlive its frame */
+   for (a = seg->attach; a != NULL; a = a->next)
+     if (shm_claim_mm(seg, a, caller->mm, 1) < 0)
+       break;
+
+   /* Every write drops the swap copy, a copy left means a clean page */
+   if (a == NULL && swap_store_frame(caller, fp->fpn, 0, &swptyp, &swpoff) == 0)
+   {
+     pte_set_swap(&seg->pte[idx], swptyp, swpoff);
+     for (b = seg->attach; b != NULL; b = b->next)
+     {
+       pte = &b->mm->pgd[b->pgn + idx];
+       if (!PAGING_PAGE_SWAPPED(*pte))
+       {
+         pte_set_swap(pte, PAGING_SWPTYP_SHM, fp->pgn);
+         fp->refcount--;
+       }
+     }
+     fp->flags &= ~FRAME_SHM;
+     ret = 0;
+   }
+
+   for (b = seg->attach; b != a; b = b->next)
+     shm_claim_mm(seg, b, caller->mm, 0);
+   if (ret < 0)
+     MEMPHY_put_usedfp(caller->mram, fp->fpn, NULL, fp->pgn);
+   pthread_mutex_unlock(&seg->lock);
+
+   return ret;
+}
+
+/*
+ *  shm_destroy_all - give back the frames and swap space of every
+ *  segment, once no process runs any more
+ */
+void shm_destroy_all(void)
+{
+   struct shm_segment *seg;
+   struct pcb_t ctx;
+   int id, idx;
+   pte_t pte;
+
+   memset(&ctx, 0, sizeof(ctx));
+   for (id = 0; id < shm_tbl.nseg; id++)
+   {
+     seg = &shm_tbl.seg[id];
+     ctx.mram = seg->mram;
+     ctx.mswp = seg->mswp;
+     for (idx = 0; idx < seg->npages; idx++)
+     {
+       pte = seg->pte[idx];
+       if (!PAGING_PAGE_PRESENT(pte))
+         continue;
+       if (PAGING_PAGE_SWAPPED(pte))
+         swap_free_slot(&ctx, PAGING_PTE_SWPTYP(pte), PAGING_SWP(pte));
+       else {
+         swap_drop_copy(&ctx, PAGING_PTE_FPN(pte));
+         MEMPHY_put_freefp(seg->mram, PAGING_PTE_FPN(pte));
+       }
+     }
+     free(seg->pte);
+     pthread_mutex_destroy(&seg->lock);
+   }
+   shm_tbl.nseg = 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * PAGING based Memory Management
+ * Slab cache mm/mm-slab.c
+ *
+ * Fixed-size metadata nodes (page list nodes, regions, free holes) come
+ * from typed caches instead of malloc. Every thread keeps a magazine of
+ * free objects per cache, alloc and free only touch the magazine. A
+ * magazine that runs empty or full moves half its capacity from or to
+ * the cache's depot under the cache lock, the depot grows by chunks of
+ * SLAB_CHUNK objects and never gives memory back.
+ *
+ * The bookkeeping of a process is not freed object by object: its
+ * mm_arena takes chunks from arena_chunk_cache, hands out objects by
+ * type and keeps freed ones for reuse. At exit the chunk list is put
+ * back on the depot whole, whatever the process allocated.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/* Free objects are linked through their first word */
+#define SLAB_OBJSZ(c) \
+  (((c)->objsz + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *))
+
+struct kmem_cache vm_rg_cache = {
+  .name = "vm_rg", .objsz = sizeof(struct vm_rg_struct), .id = 0,
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+struct kmem_cache freerg_cache = {
+  .name = "freerg", .objsz = sizeof(struct vm_freerg_struct), .id = 1,
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+struct kmem_cache mm_cache = {
+  .name = "mm", .objsz = sizeof(struct mm_struct), .id = 2,
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+struct kmem_cache vma_cache = {
+  .name = "vma", .objsz = sizeof(struct vm_area_struct), .id = 3,
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+struct kmem_cache arena_chunk_cache = {
+  .name = "arena", .objsz = MM_ARENA_CHUNKSZ, .id = 4,
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+struct kmem_cache shm_attach_cache = {
+  .name = "shm_attach", .objsz = sizeof(struct shm_attach), .id = 5,
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static struct kmem_cache *kmem_caches[SLAB_MAX_CACHE] = {
+  &vm_rg_cache, &freerg_cache, &mm_cache, &vma_cache, &arena_chunk_cache,
+  &shm_attach_cache
+};
+
+static __thread struct kmem_magazine {
+  int count;
+  void *obj[SLAB_MAG_SIZE];
+} kmem_mag[SLAB_MAX_CACHE];
+
+/*
+ *  kmem_cache_grow - carve a new chunk into the depot, caller holds c->lock
+ */
+static int kmem_cache_grow(struct kmem_cache *c)
+{
+  size_t sz = SLAB_OBJSZ(c);
+  char *chunk = malloc(sz * SLAB_CHUNK);
+  int i;
+
+  if (chunk == NULL)
+    return -1;
+
+  for (i = 0; i < SLAB_CHUNK; i++)
+  {
+    *(void **)(chunk + i * sz) = c->depot;
+    c->depot = chunk + i * sz;
+  }
+  c->nr_depot += SLAB_CHUNK;
+  c->nr_chunk++;
+
+  return 0;
+}
+
+/*
+ *  kmem_mag_refill - fill half the caller's magazine from the depot
+ */
+static void kmem_mag_refill(struct kmem_cache *c, struct kmem_magazine *m)
+{
+  pthread_mutex_lock(&c->lock);
+  while (m->count < SLAB_MAG_SIZE / 2)
+  {
+    if (c->depot == NULL && kmem_cache_grow(c) < 0)
+      break;
+    m->obj[m->count++] = c->depot;
+    c->depot = *(void **)c->depot;
+    c->nr_depot--;
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ *  kmem_mag_flush - give back the oldest @n objects of the caller's magazine
+ */
+static void kmem_mag_flush(struct kmem_cache *c, struct kmem_magazine *m, int n)
+{
+  int i;
+
+  pthread_mutex_lock(&c->lock);
+  for (i = 0; i < n; i++)
+  {
+    *(void **)m->obj[i] = c->depot;
+    c->depot = m->obj[i];
+  }
+  c->nr_depot += n;
+  pthread_mutex_unlock(&c->lock);
+
+  for (i = n; i < m->count; i++)
+    m->obj[i - n] = m->obj[i];
+  m->count -= n;
+}
+
+/*
+ *  kmem_cache_alloc - take an object from a cache
+ *  @c: cache
+ *
+ *  Return NULL if the depot can not grow
+ */
+void *kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct kmem_magazine *m = &kmem_mag[c->id];
+
+  if (m->count == 0)
+    kmem_mag_refill(c, m);
+  if (m->count == 0)
+    return NULL;
+
+  return m->obj[--m->count];
+}
+
+/*
+ *  kmem_cache_free - return an object to its cache
+ *  @c: cache the object was taken from
+ *  @obj: object, may be NULL
+ */
+void kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct kmem_magazine *m = &kmem_mag[c->id];
+
+  if (obj == NULL)
+    return;
+
+  if (m->count == SLAB_MAG_SIZE)
+    kmem_mag_flush(c, m, SLAB_MAG_SIZE / 2);
+  m->obj[m->count++] = obj;
+}
+
+/*
+ *  kmem_cache_free_bulk - return a list of objects to the depot at once
+ *  @head: first object, objects are linked through their first word
+ *  @tail: last object
+ *  @n: number of objects
+ */
+void kmem_cache_free_bulk(struct kmem_cache *c, void *head, void *tail, int n)
+{
+  pthread_mutex_lock(&c->lock);
+  *(void **)tail = c->depot;
+  c->depot = head;
+  c->nr_depot += n;
+  pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ *  kmem_cache_drain - empty the caller's magazines into the depots,
+ *  called by a thread before it exits
+ */
+void kmem_cache_drain(void)
+{
+  int i;
+
+  for (i = 0; i < SLAB_MAX_CACHE; i++)
+    if (kmem_caches[i] != NULL && kmem_mag[i].count > 0)
+      kmem_mag_flush(kmem_caches[i], &kmem_mag[i], kmem_mag[i].count);
+}
+
+/*
+ *  kmem_cache_dump - print objects carved and idle in the depot per cache
+ */
+int kmem_cache_dump(void)
+{
+  struct kmem_cache *c;
+  int i;
+
+  for (i = 0; i < SLAB_MAX_CACHE; i++)
+  {
+    if ((c = kmem_caches[i]) == NULL)
+      continue;
+    pthread_mutex_lock(&c->lock);
+    printf("slab %s: %d objects of %zu bytes, %d in depot\n", c->name,
+           c->nr_chunk * SLAB_CHUNK, SLAB_OBJSZ(c), c->nr_depot);
+    pthread_mutex_unlock(&c->lock);
+  }
+
+  return 0;
+}
+
+/*
+ *  mm_arena_init - set up an empty arena
+ */
+void mm_arena_init(struct mm_arena *a)
+{
+  int i;
+
+  a->chunks = a->last = NULL;
+  a->nr_chunk = 0;
+  a->cur = a->end = NULL;
+  for (i = 0; i < SLAB_MAX_CACHE; i++)
+    a->free[i] = NULL;
+}
+
+/*
+ *  mm_arena_alloc - take an object of the type of @c from an arena,
+ *  caller holds the lock of the mm the arena backs
+ *
+ *  Return NULL if no chunk is left
+ */
+void *mm_arena_alloc(struct mm_arena *a, struct kmem_cache *c)
+{
+  size_t sz = SLAB_OBJSZ(c);
+  char *chunk;
+  void *obj;
+
+  if ((obj = a->free[c->id]) != NULL)
+  {
+    a->free[c->id] = *(void **)obj;
+    return obj;
+  }
+
+  if (a->cur == NULL || a->cur + sz > a->end)
+  {
+    if (sz > MM_ARENA_CHUNKSZ - sizeof(void *) ||
+        (chunk = kmem_cache_alloc(&arena_chunk_cache)) == NULL)
+      return NULL;
+
+    /* The first word links the chunk into the arena */
+    *(void **)chunk = a->chunks;
+    if (a->chunks == NULL)
+      a->last = chunk;
+    a->chunks = chunk;
+    a->nr_chunk++;
+    a->cur = chunk + sizeof(void *);
+    a->end = chunk + MM_ARENA_CHUNKSZ;
+  }
+
+  obj = a->cur;
+  a->cur += sz;
+  return obj;
+}
+
+/*
+ *  mm_arena_free - keep an object for the next alloc of its type
+ */
+void mm_arena_free(struct mm_arena *a, struct kmem_cache *c, void *obj)
+{
+  if (obj == NULL)
+    return;
+
+  *(void **)obj = a->free[c->id];
+  a->free[c->id] = obj;
+}
+
+/*
+ *  mm_arena_release - give every chunk of an arena back at once, all
+ *  objects carved from it are gone afterwards
+ */
+void mm_arena_release(struct mm_arena *a)
+{
+  if (a->chunks != NULL)
+    kmem_cache_free_bulk(&arena_chunk_cache, a->chunks, a->last, a->nr_chunk);
+  mm_arena_init(a);
+}
@@ -0,0 +1,770 @@
+/*
+ * PAGING based Memory Management
+ * Swap slot allocator mm/mm-swap.c
+ *
+ * A MEMSWP device hands out page sized slots from a bitmap, one bit per
+ * slot, with a reference count per slot so a swapped page may be shared.
+ * The map is built on the first swap allocation of the device, scanning
+ * resumes from the word of the last allocation so consecutive swap-outs
+ * land in neighbouring slots.
+ *
+ * Slots in use are kept on an age list (oldest first) with the page
+ * they hold, so the tiered policy can demote the coldest slot of a fast
+ * device to a slower one.
+ *
+ * Above the slot maps, swap_alloc_slot spreads swap-outs over all the
+ * configured MEMSWP devices of a PCB; the device index is kept in the
+ * SWPTYP field of the PTE. swap_out_page/swap_in_page offer a page to
+ * the compressed cache before any device.
+ *
+ * Swap-in keeps the slot as the page's swap copy, recorded in the frame
+ * table. The first write (setting the PTE dirty bit) drops it; a page
+ * still clean when evicted goes back to its copy without any transfer.
+ *
+ * A fault on a device slot may read ahead: following virtual pages held
+ * in the following slots of the same device come in with one block read.
+ * Round-robin placement moves to the next device only after a run of
+ * swap-outs the size of the readahead window, the tiered one fills the
+ * fastest device first, so evicted neighbours stay on one device. The
+ * most-free policy picks a device per page and finds few runs.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SWPMAP_BITS (8 * sizeof(unsigned long))
+#define SWPCNT_MAX  0xffff
+
+/*
+ *  MEMPHY_free_swpmap - give back the slot map of a device, if any
+ */
+void MEMPHY_free_swpmap(struct memphy_struct *mp)
+{
+   free(mp->swp_map);
+   free(mp->swp_cnt);
+   free(mp->swp_owner);
+   free(mp->swp_pgn);
+   free(mp->swp_lnext);
+   free(mp->swp_lprev);
+   mp->swp_map = NULL;
+   mp->swp_cnt = NULL;
+   mp->swp_owner = NULL;
+   mp->swp_pgn = NULL;
+   mp->swp_lnext = mp->swp_lprev = NULL;
+   mp->swp_nr = mp->swp_free = 0;
+}
+
+/*
+ *  swpmap_init - build the slot map of a device, caller holds mp->lock
+ */
+static int swpmap_init(struct memphy_struct *mp)
+{
+   int nr = mp->maxsz / PAGING_PAGESZ;
+   int nword = (nr + SWPMAP_BITS - 1) / SWPMAP_BITS;
+
+   mp->swp_map = calloc(nword ? nword : 1, sizeof(unsigned long));
+   mp->swp_cnt = calloc(nr ? nr : 1, sizeof(unsigned short));
+   mp->swp_owner = calloc(nr ? nr : 1, sizeof(struct mm_struct *));
+   mp->swp_pgn = calloc(nr ? nr : 1, sizeof(int));
+   mp->swp_lnext = calloc(nr ? nr : 1, sizeof(int));
+   mp->swp_lprev = calloc(nr ? nr : 1, sizeof(int));
+   if (mp->swp_map == NULL || mp->swp_cnt == NULL || mp->swp_owner == NULL ||
+       mp->swp_pgn == NULL || mp->swp_lnext == NULL || mp->swp_lprev == NULL)
+   {
+     MEMPHY_free_swpmap(mp);
+     return -1;
+   }
+   mp->swp_lhead = mp->swp_ltail = -1;
+
+   /* Bits past the last slot are never free */
+   if (nr % SWPMAP_BITS)
+     mp->swp_map[nword - 1] = ~0UL << (nr % SWPMAP_BITS);
+
+   mp->swp_nr = nr;
+   mp->swp_free = nr;
+   mp->swp_hint = 0;
+   return 0;
+}
+
+/*
+ *  swplru_link/swplru_unlink - age list of slots in use, caller holds mp->lock
+ */
+static void swplru_link(struct memphy_struct *mp, int slot)
+{
+   mp->swp_lnext[slot] = -1;
+   mp->swp_lprev[slot] = mp->swp_ltail;
+   if (mp->swp_ltail >= 0)
+     mp->swp_lnext[mp->swp_ltail] = slot;
+   else
+     mp->swp_lhead = slot;
+   mp->swp_ltail = slot;
+}
+
+static void swplru_unlink(struct memphy_struct *mp, int slot)
+{
+   if (mp->swp_lprev[slot] >= 0)
+     mp->swp_lnext[mp->swp_lprev[slot]] = mp->swp_lnext[slot];
+   else
+     mp->swp_lhead = mp->swp_lnext[slot];
+   if (mp->swp_lnext[slot] >= 0)
+     mp->swp_lprev[mp->swp_lnext[slot]] = mp->swp_lprev[slot];
+   else
+     mp->swp_ltail = mp->swp_lprev[slot];
+}
+
+/*
+ *  MEMPHY_load_swpmap - rebuild the slot map a persistent device file
+ *  kept, before the device is used
+ *  @mp: swap device
+ *  @cnt: references per slot, one per slot of the device
+ *  @hint: map word to scan first
+ *
+ *  Slots still referenced when the map was saved stay taken with their
+ *  content. No page of this run maps them, so they have no owner and
+ *  are never demoted.
+ */
+int MEMPHY_load_swpmap(struct memphy_struct *mp, const unsigned short *cnt, int hint)
+{
+   int slot, nword;
+
+   if (swpmap_init(mp) < 0)
+     return -1;
+
+   for (slot = 0; slot < mp->swp_nr; slot++)
+   {
+     if (cnt[slot] == 0)
+       continue;
+     mp->swp_map[slot / SWPMAP_BITS] |= 1UL << (slot % SWPMAP_BITS);
+     mp->swp_cnt[slot] = cnt[slot];
+     mp->swp_pgn[slot] = -1;
+     swplru_link(mp, slot);
+     mp->swp_free--;
+   }
+
+   nword = (mp->swp_nr + SWPMAP_BITS - 1) / SWPMAP_BITS;
+   mp->swp_hint = (hint >= 0 && hint < nword) ? hint : 0;
+   return 0;
+}
+
+/*
+ *  MEMPHY_get_swpslot - allocate a swap slot
+ *  @mp: swap device
+ *  @slot: obtained slot, holding one reference
+ */
+int MEMPHY_get_swpslot(struct memphy_struct *mp, int *slot)
+{
+   int nword, i, w, bit;
+
+   pthread_mutex_lock(&mp->lock);
+   if (mp->swp_map == NULL && swpmap_init(mp) < 0)
+   {
+     pthread_mutex_unlock(&mp->lock);
+     return -1;
+   }
+
+   if (mp->swp_free == 0)
+   {
+     pthread_mutex_unlock(&mp->lock);
+     return -1;
+   }
+
+   nword = (mp->swp_nr + SWPMAP_BITS - 1) / SWPMAP_BITS;
+   for (i = 0; i < nword; i++)
+   {
+     w = (mp->swp_hint + i) % nword;
+     if (~mp->swp_map[w] == 0)
+       continue;
+
+     bit = __builtin_ctzl(~mp->swp_map[w]);
+     mp->swp_map[w] |= 1UL << bit;
+     *slot = w * SWPMAP_BITS + bit;
+     mp->swp_cnt[*slot] = 1;
+     mp->swp_owner[*slot] = NULL;
+     swplru_link(mp, *slot);
+     mp->swp_free--;
+     mp->swp_hint = w;
+     pthread_mutex_unlock(&mp->lock);
+     return 0;
+   }
+
+   pthread_mutex_unlock(&mp->lock);
+   return -1;
+}
+
+/*
+ *  MEMPHY_dup_swpslot - take another reference on a swap slot
+ *  @mp: swap device
+ *  @slot: slot in use
+ */
+int MEMPHY_dup_swpslot(struct memphy_struct *mp, int slot)
+{
+   int ret = -1;
+
+   pthread_mutex_lock(&mp->lock);
+   if (mp->swp_map != NULL && slot >= 0 && slot < mp->swp_nr &&
+       mp->swp_cnt[slot] > 0 && mp->swp_cnt[slot] < SWPCNT_MAX)
+   {
+     /* A shared slot has no single page to demote */
+     mp->swp_cnt[slot]++;
+     mp->swp_owner[slot] = NULL;
+     ret = 0;
+   }
+   pthread_mutex_unlock(&mp->lock);
+
+   return ret;
+}
+
+/*
+ *  MEMPHY_put_swpslot - drop a reference on a swap slot
+ *  @mp: swap device
+ *  @slot: slot in use
+ *
+ *  Return the references left, the slot is free again once it reaches 0
+ */
+int MEMPHY_put_swpslot(struct memphy_struct *mp, int slot)
+{
+   int ret = -1;
+
+   pthread_mutex_lock(&mp->lock);
+   if (mp->swp_map != NULL && slot >= 0 && slot < mp->swp_nr &&
+       mp->swp_cnt[slot] > 0)
+   {
+     ret = --mp->swp_cnt[slot];
+     if (ret == 0)
+     {
+       mp->swp_map[slot / SWPMAP_BITS] &= ~(1UL << (slot % SWPMAP_BITS));
+       swplru_unlink(mp, slot);
+       mp->swp_free++;
+     }
+   }
+   pthread_mutex_unlock(&mp->lock);
+
+   return ret;
+}
+
+/*
+ *  MEMPHY_nr_free_swpslot - number of free swap slots
+ *  @mp: swap device
+ */
+int MEMPHY_nr_free_swpslot(struct memphy_struct *mp)
+{
+   int nr;
+
+   pthread_mutex_lock(&mp->lock);
+   nr = (mp->swp_map != NULL) ? mp->swp_free : mp->maxsz / PAGING_PAGESZ;
+   pthread_mutex_unlock(&mp->lock);
+
+   return nr;
+}
+
+/*
+ *  MEMPHY_set_swpowner - record the page a swap slot holds
+ *  @mp: swap device
+ *  @slot: slot holding a single reference
+ *  @mm: owner mm
+ *  @pgn: page of the owner
+ */
+int MEMPHY_set_swpowner(struct memphy_struct *mp, int slot,
+                        struct mm_struct *mm, int pgn)
+{
+   int ret = -1;
+
+   pthread_mutex_lock(&mp->lock);
+   if (mp->swp_map != NULL && slot >= 0 && slot < mp->swp_nr &&
+       mp->swp_cnt[slot] == 1)
+   {
+     mp->swp_owner[slot] = mm;
+     mp->swp_pgn[slot] = pgn;
+     ret = 0;
+   }
+   pthread_mutex_unlock(&mp->lock);
+
+   return ret;
+}
+
+/*
+ *  MEMPHY_get_coldswp - oldest slot of a device with a known owner
+ *  @mp: swap device
+ *  @self: mm the caller already holds, NULL for none
+ *  @slot: the slot
+ *  @mm: owner mm, claimed (mm_claim) for the caller
+ *  @pgn: page of the owner
+ */
+int MEMPHY_get_coldswp(struct memphy_struct *mp, struct mm_struct *self,
+                       int *slot, struct mm_struct **mm, int *pgn)
+{
+   int s;
+
+   pthread_mutex_lock(&mp->lock);
+   for (s = (mp->swp_map != NULL) ? mp->swp_lhead : -1; s >= 0; s = mp->swp_lnext[s])
+   {
+     if (mm_claim(mp->swp_owner[s], self) < 0)
+       continue;
+
+     *slot = s;
+     *mm = mp->swp_owner[s];
+     *pgn = mp->swp_pgn[s];
+     pthread_mutex_unlock(&mp->lock);
+     return 0;
+   }
+   pthread_mutex_unlock(&mp->lock);
+
+   return -1;
+}
+
+/*
+ * Swap placement policy, shared by every PCB
+ */
+static int swp_policy = SWP_POLICY_RR;
+static unsigned int swp_rr;
+
+/* Readahead window in pages, also the run round-robin keeps on a device */
+static int swp_ra_pages;
+
+/*
+ *  swap_set_policy - select how swap-outs are placed on the devices
+ *  @name: "RR" round-robin, "FREE" most free space or "TIER" tiered
+ */
+int swap_set_policy(const char *name)
+{
+   if (strcmp(name, "RR") == 0)
+     swp_policy = SWP_POLICY_RR;
+   else if (strcmp(name, "FREE") == 0)
+     swp_policy = SWP_POLICY_FREE;
+   else if (strcmp(name, "TIER") == 0)
+     swp_policy = SWP_POLICY_TIER;
+   else
+     return -1;
+
+   return 0;
+}
+
+/*
+ *  swap_tiers - devices with space configured, fastest first
+ *  @caller: caller
+ *  @tier: device indexes
+ */
+static int swap_tiers(struct pcb_t *caller, int *tier)
+{
+   int i, j, n = 0;
+
+   for (i = 0; i < PAGING_MAX_MMSWP; i++)
+   {
+     if (caller->mswp[i] == NULL || caller->mswp[i]->maxsz < PAGING_PAGESZ)
+       continue;
+
+     /* Insertion by latency, equal devices keep their index order */
+     for (j = n++; j > 0 && caller->mswp[tier[j - 1]]->lat > caller->mswp[i]->lat; j--)
+       tier[j] = tier[j - 1];
+     tier[j] = i;
+   }
+
+   return n;
+}
+
+/*
+ *  swap_demote - make room on a tier by moving its coldest page down
+ *  @caller: caller
+ *  @tier: devices fastest first
+ *  @ntier: number of devices
+ *  @k: tier to make room on
+ */
+static int swap_demote(struct pcb_t *caller, int *tier, int ntier, int k)
+{
+   struct memphy_struct *fast, *slow;
+   struct mm_struct *mm;
+   int slot, pgn, newslot, ret = -1;
+   pte_t *pte;
+
+   if (k + 1 >= ntier)
+     return -1;
+
+   fast = caller->mswp[tier[k]];
+   slow = caller->mswp[tier[k + 1]];
+
+   if (MEMPHY_get_coldswp(fast, caller->mm, &slot, &mm, &pgn) < 0)
+     return -1;
+
+   /* The slower tier may have to make room first */
+   if (MEMPHY_get_swpslot(slow, &newslot) == 0 ||
+       (swap_demote(caller, tier, ntier, k + 1) == 0 &&
+        MEMPHY_get_swpslot(slow, &newslot) == 0))
+   {
+     pte = &mm->pgd[pgn];
+     if (PAGING_PAGE_SWAPPED(*pte) && PAGING_PTE_SWPTYP(*pte) == tier[k] &&
+         PAGING_SWP(*pte) == slot)
+     {
+       MEMPHY_set_swpowner(slow, newslot, mm, pgn);
+       __swap_cp_page(fast, slot, slow, newslot);
+       pte_set_swap(pte, tier[k + 1], newslot);
+       MEMPHY_put_swpslot(fast, slot);
+       ret = 0;
+     } else
+       MEMPHY_put_swpslot(slow, newslot); /* The owner no longer maps it there */
+   }
+
+   mm_unclaim(mm, caller->mm);
+   return ret;
+}
+
+/*
+ *  swap_alloc_slot - pick a swap device and a slot on it
+ *  @caller: caller
+ *  @swptyp: device index, the SWPTYP of the PTE
+ *  @slot: obtained slot
+ */
+int swap_alloc_slot(struct pcb_t *caller, int *swptyp, int *slot)
+{
+   int tier[PAGING_MAX_MMSWP];
+   int ntier, i, best, nfree, bestfree;
+
+   ntier = swap_tiers(caller, tier);
+   if (ntier == 0)
+     return -1;
+
+   switch (swp_policy) {
+   case SWP_POLICY_TIER:
+     /* Pages leaving RAM are the hottest in swap, they go fast */
+     if (MEMPHY_get_swpslot(caller->mswp[tier[0]], slot) == 0 ||
+         (swap_demote(caller, tier, ntier, 0) == 0 &&
+          MEMPHY_get_swpslot(caller->mswp[tier[0]], slot) == 0))
+     {
+       *swptyp = tier[0];
+       return 0;
+     }
+     break;
+
+   case SWP_POLICY_FREE:
+     best = -1;
+     bestfree = 0;
+     for (i = 0; i < ntier; i++)
+     {
+       nfree = MEMPHY_nr_free_swpslot(caller->mswp[tier[i]]);
+       if (nfree > bestfree)
+       {
+         best = tier[i];
+         bestfree = nfree;
+       }
+     }
+     if (best >= 0 && MEMPHY_get_swpslot(caller->mswp[best], slot) == 0)
+     {
+       *swptyp = best;
+       return 0;
+     }
+     break;
+
+   default:
+     break;
+   }
+
+   /* Round-robin, also the fallback when the policy found no slot. With
+    * readahead on, a run of swap-outs as long as its window stays on one
+    * device, so the pages evicted together sit in neighbouring slots */
+   best = __sync_fetch_and_add(&swp_rr, 1) / (swp_ra_pages > 1 ? swp_ra_pages : 1);
+   for (i = 0; i < ntier; i++)
+   {
+     *swptyp = tier[(best + i) % ntier];
+     if (MEMPHY_get_swpslot(caller->mswp[*swptyp], slot) == 0)
+       return 0;
+   }
+
+   return -1;
+}
+
+/*
+ *  swap_nr_free - free slots left on all swap devices
+ *  @caller: caller
+ */
+int swap_nr_free(struct pcb_t *caller)
+{
+   int tier[PAGING_MAX_MMSWP];
+   int ntier, i, n = 0;
+
+   ntier = swap_tiers(caller, tier);
+   for (i = 0; i < ntier; i++)
+     n += MEMPHY_nr_free_swpslot(caller->mswp[tier[i]]);
+
+   return n;
+}
+
+/*
+ *  swap_free_slot - drop the reference a PTE holds on a swap slot
+ *  @caller: caller
+ *  @swptyp: device index
+ *  @slot: slot
+ */
+int swap_free_slot(struct pcb_t *caller, int swptyp, int slot)
+{
+   if (swptyp == PAGING_SWPTYP_ZSWAP)
+     return zswap_put(slot);
+
+   if (swptyp < 0 || swptyp >= PAGING_MAX_MMSWP || caller->mswp[swptyp] == NULL)
+     return -1;
+
+   return MEMPHY_put_swpslot(caller->mswp[swptyp], slot);
+}
+
+/*
+ *  swap_keep_copy - record the slot a page was swapped in from
+ *  @caller: caller
+ *  @fpn: frame now holding the page
+ *  @swptyp: device index of the slot
+ *  @slot: the slot, its reference passes to the frame
+ */
+static void swap_keep_copy(struct pcb_t *caller, int fpn, int swptyp, int slot)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(caller->mram, fpn);
+
+   /* An online page has nothing to demote */
+   MEMPHY_set_swpowner(caller->mswp[swptyp], slot, NULL, -1);
+
+   fp->swptyp = swptyp;
+   fp->swpoff = slot;
+}
+
+/*
+ *  swap_drop_copy - release the swap copy of an online page
+ *  @caller: caller
+ *  @fpn: frame holding the page
+ */
+int swap_drop_copy(struct pcb_t *caller, int fpn)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(caller->mram, fpn);
+   int slot;
+
+   if (fp == NULL || fp->swpoff < 0)
+     return 0;
+
+   slot = fp->swpoff;
+   fp->swpoff = -1;
+   return swap_free_slot(caller, fp->swptyp, slot);
+}
+
+/*
+ *  swap_store_frame - put the content of an online frame in swap
+ *  @caller: caller
+ *  @fpn: frame holding the page, left to the caller
+ *  @dirty: the page was written since its swap copy was made
+ *  @swptyp: where it went, a device index or PAGING_SWPTYP_ZSWAP
+ *  @swpoff: slot or cache entry
+ *
+ *  A device slot comes with no owner recorded
+ */
+int swap_store_frame(struct pcb_t *caller, int fpn, int dirty, int *swptyp, int *swpoff)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(caller->mram, fpn);
+
+   /* Clean page, its swap copy is still good */
+   if (fp->swpoff >= 0 && !dirty)
+   {
+     *swptyp = fp->swptyp;
+     *swpoff = fp->swpoff;
+     fp->swpoff = -1;
+     return 0;
+   }
+   swap_drop_copy(caller, fpn);
+
+   if (zswap_store(caller->mram, fpn, swpoff) == 0)
+   {
+     *swptyp = PAGING_SWPTYP_ZSWAP;
+     return 0;
+   }
+
+   if (swap_alloc_slot(caller, swptyp, swpoff) < 0)
+     return -1;
+
+   __swap_cp_page(caller->mram, fpn, caller->mswp[*swptyp], *swpoff);
+   return 0;
+}
+
+/*
+ *  swap_out_page - move an online page out of MEMRAM
+ *  @caller: caller
+ *  @mm: owner of the page
+ *  @pgn: page number
+ *  @fpn: frame holding the page, left to the caller
+ *
+ *  Fails if the owner's group is at its swap limit
+ */
+int swap_out_page(struct pcb_t *caller, struct mm_struct *mm, int pgn, int fpn)
+{
+   int swptyp, swpoff;
+
+   if (memcg_try_charge(mm, MEMCG_SWP) < 0)
+     return -1;
+
+   if (swap_store_frame(caller, fpn, mm->pgd[pgn] & PAGING_PTE_DIRTY_MASK,
+                        &swptyp, &swpoff) < 0)
+   {
+     memcg_charge(mm, 0, -1);
+     return -1;
+   }
+
+   if (swptyp != PAGING_SWPTYP_ZSWAP)
+     MEMPHY_set_swpowner(caller->mswp[swptyp], swpoff, mm, pgn);
+   pte_set_swap(&mm->pgd[pgn], swptyp, swpoff);
+   memcg_charge(mm, -1, 0);
+
+   return 0;
+}
+
+/*
+ *  swap_in_page - bring a swapped page into a MEMRAM frame
+ *  @caller: caller
+ *  @pte: the swapped PTE
+ *  @fpn: destination frame
+ *
+ *  A device slot stays with the frame as the page's swap copy, a cache
+ *  entry is released
+ */
+int swap_in_page(struct pcb_t *caller, pte_t pte, int fpn)
+{
+   int swptyp = PAGING_PTE_SWPTYP(pte);
+   int slot = PAGING_SWP(pte);
+
+   if (swptyp == PAGING_SWPTYP_ZSWAP)
+   {
+     /* The cache is RAM too, a duplicate is not worth keeping */
+     if (zswap_load(slot, fpn) < 0)
+       return -1;
+     zswap_put(slot);
+     return 0;
+   } else if (swptyp < PAGING_MAX_MMSWP && caller->mswp[swptyp] != NULL) {
+     __swap_cp_page(caller->mswp[swptyp], slot, caller->mram, fpn);
+   } else
+     return -1;
+
+   swap_keep_copy(caller, fpn, swptyp, slot);
+   return 0;
+}
+
+/*
+ * Swap readahead statistics, shared by every PCB
+ */
+static unsigned long swp_ra_read, swp_ra_hits, swp_ra_waste;
+
+/*
+ *  swap_set_readahead - set the readahead window
+ *  @npages: pages read per fault, the faulting one included (0, 1: off),
+ *  at most SWAP_RA_MAX
+ */
+int swap_set_readahead(int npages)
+{
+   swp_ra_pages = (npages < 0) ? 0 : (npages > SWAP_RA_MAX) ? SWAP_RA_MAX : npages;
+   return 0;
+}
+
+/*
+ *  swap_ra_next - check a page is swapped in a given device slot
+ */
+static int swap_ra_next(struct mm_struct *mm, int pgn, int swptyp, int slot)
+{
+   pte_t pte = mm->pgd[pgn];
+
+   return PAGING_PAGE_SWAPPED(pte) && PAGING_PTE_SWPTYP(pte) == swptyp &&
+          PAGING_SWP(pte) == slot;
+}
+
+/*
+ *  swap_readahead - bring in the pages following a faulting page
+ *  @caller: caller
+ *  @mm: owner of the pages
+ *  @pgn: faulting page
+ *  @pte: its PTE before the fault
+ *
+ *  Return the number of pages read ahead
+ */
+int swap_readahead(struct pcb_t *caller, struct mm_struct *mm, int pgn, pte_t pte)
+{
+   int swptyp = PAGING_PTE_SWPTYP(pte);
+   int slot = PAGING_SWP(pte);
+   int fpn[SWAP_RA_MAX];
+   struct memphy_struct *swp;
+   BYTE *buf;
+   int n, i;
+
+   if (swp_ra_pages <= 1 || swptyp >= PAGING_MAX_MMSWP)
+     return 0;
+   swp = caller->mswp[swptyp];
+
+   /* Neighbours in the neighbouring slots */
+   for (n = 0; n + 1 < swp_ra_pages && pgn + n + 1 < PAGING_MAX_PGN; n++)
+   {
+     /* Read ahead only within the resident limit */
+     if (!swap_ra_next(mm, pgn + n + 1, swptyp, slot + n + 1) ||
+         memcg_try_charge(mm, MEMCG_RSS) < 0)
+       break;
+     if (alloc_frame(caller, &fpn[n]) < 0)
+     {
+       memcg_charge(mm, -1, 0);
+       break;
+     }
+   }
+
+   /* Making room may have moved some of them, keep the run still in place */
+   for (i = 0; i < n && swap_ra_next(mm, pgn + i + 1, swptyp, slot + i + 1); i++);
+   memcg_charge(mm, i - n, 0);
+   while (n > i)
+     MEMPHY_put_freefp(caller->mram, fpn[--n]);
+   if (n == 0)
+     return 0;
+
+   buf = malloc(n * PAGING_PAGESZ);
+   if (buf == NULL || MEMPHY_read_block(swp, (slot + 1) * PAGING_PAGESZ, buf, n * PAGING_PAGESZ) < 0)
+   {
+     for (i = 0; i < n; i++)
+       MEMPHY_put_freefp(caller->mram, fpn[i]);
+     memcg_charge(mm, -n, 0);
+     free(buf);
+     return 0;
+   }
+   /* One positioning for the whole batch */
+   swp->io_cost += swp->lat;
+
+   for (i = 0; i < n; i++)
+   {
+     MEMPHY_write_block(caller->mram, fpn[i] * PAGING_PAGESZ, buf + i * PAGING_PAGESZ, PAGING_PAGESZ);
+     pte_set_fpn(&mm->pgd[pgn + i + 1], fpn[i]);
+     MEMPHY_put_usedfp(caller->mram, fpn[i], mm, pgn + i + 1);
+     __sync_fetch_and_or(&MEMPHY_get_frame(caller->mram, fpn[i])->flags, FRAME_RA);
+     swap_keep_copy(caller, fpn[i], swptyp, slot + i + 1);
+   }
+   memcg_charge(mm, 0, -n);
+   free(buf);
+
+   __sync_fetch_and_add(&swp_ra_read, n);
+   return n;
+}
+
+/*
+ *  swap_ra_touch - account the first use of a page that was read ahead
+ *  @mram: RAM device
+ *  @fpn: frame of the page
+ *  @used: the page is accessed (hit), or leaves RAM untouched (waste)
+ */
+void swap_ra_touch(struct memphy_struct *mram, int fpn, int used)
+{
+   struct framephy_struct *fp = MEMPHY_get_frame(mram, fpn);
+
+   if (fp == NULL || !(fp->flags & FRAME_RA))
+     return;
+
+   if (__sync_fetch_and_and(&fp->flags, ~FRAME_RA) & FRAME_RA)
+     __sync_fetch_and_add(used ? &swp_ra_hits : &swp_ra_waste, 1);
+}
+
+/*
+ *  swap_ra_dump - print readahead statistics, if readahead is enabled
+ */
+int swap_ra_dump(void)
+{
+   if (swp_ra_pages <= 1)
+     return -1;
+
+   printf("swap readahead: %lu pages read, %lu hits, %lu wasted\n",
+          swp_ra_read, swp_ra_hits, swp_ra_waste);
+   return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * PAGING based Memory Management
+ * Symbol region table mm/mm-symtbl.c
+ *
+ * Maps region IDs (the variable operands of ALLOC/FREE/READ/WRITE) to
+ * their vm regions. Live regions are stored densely in rg[]/rgid[] and
+ * an open addressing hash with linear probing maps an ID to its dense
+ * index. Both arrays double on demand, removal moves the last entry into
+ * the hole, so storage is proportional to live regions and every
+ * operation is O(1) amortized.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+
+#define SYMTBL_EMPTY (-1)
+
+static unsigned int symtbl_hash(struct vm_symtbl *t, int rgid)
+{
+  /* Fibonacci hashing, nslot is a power of two */
+  return ((uint32_t)rgid * 2654435769U) & (t->nslot - 1);
+}
+
+/* The old slots are kept if the new ones can not be had */
+static int symtbl_rehash(struct vm_symtbl *t, int nslot)
+{
+  int i, *slot;
+  unsigned int h;
+
+  slot = malloc(nslot * sizeof(int));
+  if (slot == NULL)
+    return -1;
+
+  free(t->slot);
+  t->nslot = nslot;
+  t->slot = slot;
+  for (i = 0; i < nslot; i++)
+    t->slot[i] = SYMTBL_EMPTY;
+
+  for (i = 0; i < t->nr; i++) {
+    h = symtbl_hash(t, t->rgid[i]);
+    while (t->slot[h] != SYMTBL_EMPTY)
+      h = (h + 1) & (nslot - 1);
+    t->slot[h] = i;
+  }
+  return 0;
+}
+
+/* Hash slot holding @rgid, or -1 */
+static int symtbl_find_slot(struct vm_symtbl *t, int rgid)
+{
+  unsigned int h;
+
+  if (t->nslot == 0)
+    return -1;
+
+  h = symtbl_hash(t, rgid);
+  while (t->slot[h] != SYMTBL_EMPTY) {
+    if (t->rgid[t->slot[h]] == rgid)
+      return h;
+    h = (h + 1) & (t->nslot - 1);
+  }
+  return -1;
+}
+
+void vm_symtbl_init(struct vm_symtbl *t, int cap)
+{
+  int nslot = 1;
+
+  if (cap <= 0)
+    cap = 1;
+  while (nslot < 2 * cap)
+    nslot <<= 1;
+
+  t->rg = malloc(cap * sizeof(struct vm_rg_struct));
+  t->rgid = malloc(cap * sizeof(int));
+  t->nr = 0;
+  t->cap = (t->rg != NULL && t->rgid != NULL) ? cap : 0;
+  t->slot = NULL;
+  t->nslot = 0;
+  symtbl_rehash(t, nslot);
+}
+
+struct vm_rg_struct *vm_symtbl_lookup(struct vm_symtbl *t, int rgid)
+{
+  int h = symtbl_find_slot(t, rgid);
+
+  return (h < 0) ? NULL : &t->rg[t->slot[h]];
+}
+
+/*
+ * vm_symtbl_insert - region entry of @rgid, created empty if missing
+ * The returned pointer is valid until the next insert or remove. NULL
+ * if the table can not grow, it is left as it was.
+ */
+struct vm_rg_struct *vm_symtbl_insert(struct vm_symtbl *t, int rgid)
+{
+  struct vm_rg_struct *rg = vm_symtbl_lookup(t, rgid);
+  int *rgid_tbl;
+  int cap;
+  unsigned int h;
+
+  if (rg != NULL)
+    return rg;
+  if (rgid < 0)
+    return NULL;
+
+  if (t->nr == t->cap) {
+    cap = t->cap ? 2 * t->cap : 1;
+    rg = realloc(t->rg, cap * sizeof(struct vm_rg_struct));
+    if (rg == NULL)
+      return NULL;
+    t->rg = rg;
+    rgid_tbl = realloc(t->rgid, cap * sizeof(int));
+    if (rgid_tbl == NULL)
+      return NULL;
+    t->rgid = rgid_tbl;
+    t->cap = cap;
+  }
+  /* Keep the load factor at or below 1/2 */
+  if (2 * (t->nr + 1) > t->nslot &&
+      symtbl_rehash(t, t->nslot ? 2 * t->nslot : 2) < 0)
+    return NULL;
+
+  rg = &t->rg[t->nr];
+  rg->rg_start = rg->rg_end = 0;
+  rg->vmaid = 0;
+  rg->shmid = -1;
+  rg->rg_next = NULL;
+  t->rgid[t->nr] = rgid;
+
+  h = symtbl_hash(t, rgid);
+  while (t->slot[h] != SYMTBL_EMPTY)
+    h = (h + 1) & (t->nslot - 1);
+  t->slot[h] = t->nr++;
+
+  return rg;
+}
+
+int vm_symtbl_remove(struct vm_symtbl *t, int rgid)
+{
+  int h = symtbl_find_slot(t, rgid);
+  int idx, last, i, j;
+  unsigned int home;
+
+  if (h < 0)
+    return -1;
+
+  /* Fill the dense hole with the last entry */
+  idx = t->slot[h];
+  last = t->nr - 1;
+  if (idx != last) {
+    t->slot[symtbl_find_slot(t, t->rgid[last])] = idx;
+    t->rg[idx] = t->rg[last];
+    t->rgid[idx] = t->rgid[last];
+  }
+  t->nr--;
+
+  /* Backward shift deletion keeps probe chains intact without tombstones */
+  i = h;
+  j = h;
+  for (;;) {
+    t->slot[i] = SYMTBL_EMPTY;
+    do {
+      j = (j + 1) & (t->nslot - 1);
+      if (t->slot[j] == SYMTBL_EMPTY)
+        return 0;
+      home = symtbl_hash(t, t->rgid[t->slot[j]]);
+    } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+    t->slot[i] = t->slot[j];
+    i = j;
+  }
+}
+
+void vm_symtbl_destroy(struct vm_symtbl *t)
+{
+  free(t->rg);
+  free(t->rgid);
+  free(t->slot);
+  t->rg = NULL;
+  t->rgid = NULL;
+  t->slot = NULL;
+  t->nr = t->cap = t->nslot = 0;
+}
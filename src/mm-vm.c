@@ -8,51 +8,117 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 
 /*enlist_vm_freerg_list - add new rg to freerg_list
- *@mm: memory region
+ *@vma: vm area owning the region
  *@rg_elmt: new region
  *
+ * The region is merged with the free holes right before and after it.
  */
-int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt)
+int enlist_vm_freerg_list(struct vm_area_struct *vma, struct vm_rg_struct *rg_elmt)
 {
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
+  /* Enlist the new region */
+  return vm_freerg_insert(&vma->vm_freerg, rg_elmt->rg_start, rg_elmt->rg_end);
+}
 
-  if (rg_elmt->rg_start >= rg_elmt->rg_end)
-    return -1;
+/*
+ * VM area interval tree
+ * Areas never overlap, but vm_end moves as an area grows, so the tree
+ * is augmented with the largest vm_end of each subtree and an area is
+ * re-keyed (erase + insert) whenever its bounds change.
+ */
+#define VMA_ENTRY(n) avl_entry(n, struct vm_area_struct, vm_itnode)
 
-  if (rg_node != NULL)
-    rg_elmt->rg_next = rg_node;
+static int vma_itree_cmp(const struct avl_node *a, const struct avl_node *b)
+{
+  struct vm_area_struct *va = VMA_ENTRY(a), *vb = VMA_ENTRY(b);
 
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list = rg_elmt;
+  if (va->vm_start != vb->vm_start)
+    return (va->vm_start < vb->vm_start) ? -1 : 1;
+  return (va->vm_id < vb->vm_id) ? -1 : (va->vm_id > vb->vm_id);
+}
 
-  return 0;
+static void vma_itree_augment(struct avl_node *n)
+{
+  struct vm_area_struct *vma = VMA_ENTRY(n);
+
+  vma->vm_maxend = vma->vm_end;
+  if (n->avl_left && VMA_ENTRY(n->avl_left)->vm_maxend > vma->vm_maxend)
+    vma->vm_maxend = VMA_ENTRY(n->avl_left)->vm_maxend;
+  if (n->avl_right && VMA_ENTRY(n->avl_right)->vm_maxend > vma->vm_maxend)
+    vma->vm_maxend = VMA_ENTRY(n->avl_right)->vm_maxend;
 }
 
-/*get_vma_by_num - get vm area by numID
+/*
+ * vma_itree_overlap - any area but @self intersecting [start, end)
+ */
+static struct vm_area_struct *vma_itree_overlap(struct avl_node *n,
+        addr_t start, addr_t end, struct vm_area_struct *self)
+{
+  struct vm_area_struct *vma, *hit;
+
+  if (n == NULL || VMA_ENTRY(n)->vm_maxend <= start)
+    return NULL;
+
+  hit = vma_itree_overlap(n->avl_left, start, end, self);
+  if (hit != NULL)
+    return hit;
+
+  vma = VMA_ENTRY(n);
+  if (vma->vm_start >= end)
+    return NULL; /* Right subtree starts even higher */
+  if (vma != self && start < vma->vm_end && vma->vm_start < end)
+    return vma;
+
+  return vma_itree_overlap(n->avl_right, start, end, self);
+}
+
+/*vma_create - set up an empty vm area at the bottom of its span
  *@mm: memory region
- *@vmaid: ID vm area to alloc memory region
+ *@vmaid: ID of the new vm area
  *
  */
-struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid)
+struct vm_area_struct *vma_create(struct mm_struct *mm, int vmaid)
 {
-  struct vm_area_struct *pvma= mm->mmap;
+  struct vm_area_struct *vma, **pvma;
 
-  if(mm->mmap == NULL)
+  if (vmaid < 0 || vmaid >= PAGING_MAX_VMA || mm->vmatbl[vmaid] != NULL)
     return NULL;
 
-  int vmait = 0;
-  
-  while (vmait < vmaid)
-  {
-    if(pvma == NULL)
-	  return NULL;
+  if ((vma = mm_arena_alloc(mm->arena, &vma_cache)) == NULL)
+    return NULL;
+  vma->vm_id = vmaid;
+  vma->vm_start = PAGING_VMA_BASE(vmaid);
+  vma->vm_end = vma->vm_start;
+  vma->sbrk = vma->vm_start;
+  vm_freerg_init(&vma->vm_freerg, mm->arena);
+  vma->vm_mm = mm; /*point back to vma owner */
+
+  /* Keep mmap ordered by id for the dumps */
+  pvma = &mm->mmap;
+  while (*pvma != NULL && (*pvma)->vm_id < vmaid)
+    pvma = &(*pvma)->vm_next;
+  vma->vm_next = *pvma;
+  *pvma = vma;
+
+  mm->vmatbl[vmaid] = vma;
+  avl_insert(&mm->vma_itree, &vma->vm_itnode, vma_itree_cmp, vma_itree_augment);
+
+  return vma;
+}
 
-    pvma = pvma->vm_next;
-  }
+/*get_vma_by_num - get vm area by numID
+ *@mm: memory region
+ *@vmaid: ID vm area to alloc memory region
+ *
+ */
+struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid)
+{
+  if (vmaid < 0 || vmaid >= PAGING_MAX_VMA)
+    return NULL;
 
-  return pvma;
+  return mm->vmatbl[vmaid];
 }
 
 /*get_symrg_byid - get mem region by region ID
@@ -62,13 +128,25 @@ struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid)
  */
 struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
 {
-  if(rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
-    return NULL;
-  if (mm->symrgtbl[rgid].rg_start == 0 && mm->symrgtbl[rgid].rg_end == 0) {
+  struct vm_rg_struct *rg = vm_symtbl_lookup(&mm->symrgtbl, rgid);
+
+  if (rg == NULL) {
     printf("Segmentation Fault \n");
     return NULL;
   }
-  return &mm->symrgtbl[rgid];
+  return rg;
+}
+
+/*get_symrg_vmaid - ID of the vm area a region was allocated from
+ *@mm: memory region
+ *@rgid: region ID act as symbol index of variable
+ *
+ */
+int get_symrg_vmaid(struct mm_struct *mm, int rgid)
+{
+  struct vm_rg_struct *rg = vm_symtbl_lookup(&mm->symrgtbl, rgid);
+
+  return (rg == NULL) ? 0 : rg->vmaid;
 }
 
 /*__alloc - allocate a region memory
@@ -78,55 +156,136 @@ struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
  *@size: allocated size 
  *@alloc_addr: address of allocated memory region
  *
+ * Runs under the caller's mm lock, like __free, __read and __write.
  */
-int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr) {
+int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, addr_t *alloc_addr) {
     /* Allocate at the top of the roof */
     struct vm_rg_struct rgnode;
-    if (get_free_vmrg_area(caller, vmaid, size, &rgnode) == 0) {
-        caller->mm->symrgtbl[rgid].rg_start = rgnode.rg_start;
-        caller->mm->symrgtbl[rgid].rg_end = rgnode.rg_end;
-
-        *alloc_addr = rgnode.rg_start;
-        // Print status
-        printf("Allocation for Process %d - size needed %d\n", caller->pid, size);
-        printf("---------------- PAGE TABLE AND FREE_RG LIST CONTENT ---------------- \n");
-        print_pgtbl(caller, 0, -1);
-        print_list_vma(caller->mm->mmap);
-        print_list_rg(caller->mm->mmap->vm_freerg_list);
-        return 0;
+    struct vm_area_struct *cur_vma;
+
+    struct vm_rg_struct *symrg;
+
+    if (rgid < 0)
+        return -1;
+
+    pthread_mutex_lock(&caller->mm->lock);
+    if (caller->mm->oom_killed) {
+        pthread_mutex_unlock(&caller->mm->lock);
+        return -1;
+    }
+    cur_vma = get_vma_by_num(caller->mm, vmaid);
+
+    /* An attached segment is only given up by free/shmdt */
+    symrg = vm_symtbl_lookup(&caller->mm->symrgtbl, rgid);
+    if (symrg != NULL && symrg->shmid >= 0) {
+        pthread_mutex_unlock(&caller->mm->lock);
+        return -1;
+    }
+
+    /* Areas other than the heap are set up on first use */
+    if (cur_vma == NULL && (cur_vma = vma_create(caller->mm, vmaid)) == NULL) {
+        pthread_mutex_unlock(&caller->mm->lock);
+        return -1;
     }
 
-    /* TODO: Handle the region management when get_free_vmrg_area FAILED (Fig.6) */
+    if (get_free_vmrg_area(caller, vmaid, size, &rgnode) != 0) {
+        /* TODO: Handle the region management when get_free_vmrg_area FAILED (Fig.6) */
+        struct vm_freerg_struct *tail = vm_freerg_last(&cur_vma->vm_freerg);
+        int inc_sz = PAGING_PAGE_ALIGNSZ(size);
+        struct vm_rg_struct newrg;
 
-    /* Attempt to increase limit to get space */
-    struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-    int inc_sz = PAGING_PAGE_ALIGNSZ(size);
-    int old_sbrk;
-    old_sbrk = cur_vma->sbrk;
-
-    /* TODO: INCREASE THE LIMIT */
-    inc_vma_limit(caller, vmaid, inc_sz);
-
-    /* Successful increase limit */
-    caller->mm->symrgtbl[rgid].rg_start = old_sbrk;
-    caller->mm->symrgtbl[rgid].rg_end = old_sbrk + size;
-    if (old_sbrk + size < cur_vma->sbrk) {
-        struct vm_rg_struct *left_rg = malloc(sizeof(struct vm_rg_struct));
-        left_rg->rg_start = old_sbrk + size;
-        left_rg->rg_end = cur_vma->sbrk;
-        enlist_vm_freerg_list(caller->mm, left_rg);
+        /* A hole ending at sbrk is grown rather than stranded below it */
+        if (tail != NULL && tail->rg_end == cur_vma->sbrk)
+            inc_sz = PAGING_PAGE_ALIGNSZ(size - (tail->rg_end - tail->rg_start));
+
+        /* Attempt to increase limit to get space */
+        newrg.rg_start = cur_vma->sbrk;
+        if (inc_vma_limit(caller, vmaid, inc_sz) < 0) {
+            pthread_mutex_unlock(&caller->mm->lock);
+            return -1;
+        }
+        newrg.rg_end = cur_vma->sbrk;
+
+        /* Successful increase limit, the new space joins the free holes */
+        if (enlist_vm_freerg_list(cur_vma, &newrg) < 0 ||
+            get_free_vmrg_area(caller, vmaid, size, &rgnode) != 0) {
+            pthread_mutex_unlock(&caller->mm->lock);
+            return -1;
+        }
     }
-    *alloc_addr = old_sbrk;
 
+    symrg = vm_symtbl_insert(&caller->mm->symrgtbl, rgid);
+    if (symrg == NULL) {
+        /* No room for the symbol, the region goes back to the holes */
+        enlist_vm_freerg_list(cur_vma, &rgnode);
+        pthread_mutex_unlock(&caller->mm->lock);
+        return -1;
+    }
+    symrg->rg_start = rgnode.rg_start;
+    symrg->rg_end = rgnode.rg_end;
+    symrg->vmaid = vmaid;
+
+    *alloc_addr = rgnode.rg_start;
     // Print status
     printf("Allocation for Process %d - size needed %d\n", caller->pid, size);
     printf("---------------- PAGE TABLE AND FREE_RG LIST CONTENT ---------------- \n");
     print_pgtbl(caller, 0, -1);
     print_list_vma(caller->mm->mmap);
-    print_list_rg(caller->mm->mmap->vm_freerg_list);
+    print_list_freerg(&cur_vma->vm_freerg);
+    pthread_mutex_unlock(&caller->mm->lock);
     return 0;
 }
 
+/*release_pgn_range - give back the frames and swap slots of pages
+ *@caller: caller
+ *@pgstart: first PGN
+ *@pgend: PGN past the range
+ */
+static void release_pgn_range(struct pcb_t *caller, int pgstart, int pgend) {
+    pte_t *pte;
+    int pgn;
+
+    for (pgn = pgstart; pgn < pgend; pgn++) {
+        pte = &caller->mm->pgd[pgn];
+        /* Segment pages go with their attachment (shm_detach) */
+        if (!PAGING_PAGE_PRESENT(*pte) || (*pte & PAGING_PTE_SHARED_MASK))
+            continue;
+
+        if (PAGING_PAGE_SWAPPED(*pte)) {
+            swap_free_slot(caller, PAGING_PTE_SWPTYP(*pte), PAGING_SWP(*pte));
+            memcg_charge(caller->mm, 0, -1);
+        } else if (*pte & PAGING_PTE_COW_MASK)
+            ksm_put(caller, PAGING_PTE_FPN(*pte));
+        else {
+            swap_ra_touch(caller->mram, PAGING_PTE_FPN(*pte), 0);
+            swap_drop_copy(caller, PAGING_PTE_FPN(*pte));
+            MEMPHY_put_freefp(caller->mram, PAGING_PTE_FPN(*pte));
+            memcg_charge(caller->mm, -1, 0);
+        }
+        *pte = 0;
+    }
+}
+
+/*release_free_pages - release the pages a freed region left unused
+ *@caller: caller
+ *@vma: vm area of the region
+ *@rg: freed region
+ *
+ * Only pages wholly inside the free hole that now covers rg are
+ * released, a page still shared with a live region is kept.
+ */
+static void release_free_pages(struct pcb_t *caller, struct vm_area_struct *vma,
+                               struct vm_rg_struct *rg) {
+    struct vm_freerg_struct *hole = vm_freerg_find(&vma->vm_freerg, rg->rg_start);
+
+    if (hole == NULL)
+        return;
+
+    release_pgn_range(caller,
+                      PAGING_PGN(PAGING_PAGE_ALIGNSZ(hole->rg_start)),
+                      PAGING_PGN(hole->rg_end));
+}
+
 /*__free - remove a region memory
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -135,34 +294,46 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
  *
  */
 int __free(struct pcb_t *caller, int vmaid, int rgid) {
-    struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
-    if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
+    struct vm_rg_struct rgnode;
+    if (rgid < 0)
         return -1;
 
+    pthread_mutex_lock(&caller->mm->lock);
+
     /* TODO: Manage the collected freed region to freerg_list */
     struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
     struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-    if (currg == NULL || cur_vma == NULL) /* Invalid memory identifier */
+    if (currg == NULL || cur_vma == NULL || currg->vmaid != vmaid) { /* Invalid memory identifier */
+        pthread_mutex_unlock(&caller->mm->lock);
         return -1;
+    }
     
     // Assign values for rgnode so that it can be enlisted to freeList
-    rgnode->rg_start = caller->mm->symrgtbl[rgid].rg_start;
-    rgnode->rg_end = caller->mm->symrgtbl[rgid].rg_end;
+    rgnode.rg_start = currg->rg_start;
+    rgnode.rg_end = currg->rg_end;
 
-    // Free the freed region
-    caller->mm->symrgtbl[rgid].rg_start = 0;
-    caller->mm->symrgtbl[rgid].rg_end = 0;
-    caller->mm->symrgtbl[rgid].rg_next = NULL;
+    /* Enlist the obsoleted memory region, coalescing its neighbours */
+    if (enlist_vm_freerg_list(cur_vma, &rgnode) < 0) {
+        pthread_mutex_unlock(&caller->mm->lock);
+        return -1;
+    }
+
+    /* An attached segment leaves its pages to the sharers */
+    if (currg->shmid >= 0)
+        shm_detach(caller, currg);
 
-    /* Enlist the obsoleted memory region */
-    enlist_vm_freerg_list(caller->mm, rgnode);
-    printf("Free for Process %d: free range [%ld -%ld]\n", caller->pid, rgnode->rg_start, rgnode->rg_end);
+    // Free the freed region
+    vm_symtbl_remove(&caller->mm->symrgtbl, rgid);
+    release_free_pages(caller, cur_vma, &rgnode);
+    printf("Free for Process %d: free range [%lu -%lu]\n", caller->pid,
+           (unsigned long)rgnode.rg_start, (unsigned long)rgnode.rg_end);
     printf("---------------- PAGE TABLE AND FREE_RG LIST CONTENT ---------------- \n");
 
     /* Print Status */
     print_pgtbl(caller, 0, -1);
     print_list_vma(caller->mm->mmap);
-    print_list_rg(caller->mm->mmap->vm_freerg_list);
+    print_list_freerg(&cur_vma->vm_freerg);
+    pthread_mutex_unlock(&caller->mm->lock);
 
     return 0;
 }
@@ -171,13 +342,13 @@ int __free(struct pcb_t *caller, int vmaid, int rgid) {
  *@proc:  Process executing the instruction
  *@size: allocated size 
  *@reg_index: memory region ID (used to identify variable in symbole table)
+ *@vmaid: ID vm area to alloc memory region
  */
-int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
+int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index, uint32_t vmaid)
 {
-  int addr;
+  addr_t addr;
 
-  /* By default using vmaid = 0 */
-  return __alloc(proc, 0, reg_index, size, &addr);
+  return __alloc(proc, vmaid, reg_index, size, &addr);
 }
 
 /*pgfree - PAGING-based free a region memory
@@ -188,7 +359,22 @@ int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
 
 int pgfree_data(struct pcb_t *proc, uint32_t reg_index)
 {
-   return __free(proc, 0, reg_index);
+   return __free(proc, get_symrg_vmaid(proc->mm, reg_index), reg_index);
+}
+
+/*pgn_in_vma - check a page lies in the used part of some vm area
+ *@mm: memory region
+ *@pgn: PGN
+ */
+static int pgn_in_vma(struct mm_struct *mm, int pgn) {
+    struct vm_area_struct *vma;
+    addr_t addr = (addr_t)pgn << PAGING_PAGE_SHIFT;
+
+    for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+        if (addr >= vma->vm_start && addr < vma->sbrk)
+            return 1;
+
+    return 0;
 }
 
 /*pg_getpage - get the page in ram
@@ -199,66 +385,57 @@ int pgfree_data(struct pcb_t *proc, uint32_t reg_index)
  *
  */
 int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller) {
-    uint32_t pte = mm->pgd[pgn];
+    pte_t pte = mm->pgd[pgn];
     if (!PAGING_PAGE_PRESENT(pte)) {
-        return -1;
+        /* Pages released by __free come back zero filled on touch */
+        if (!pgn_in_vma(mm, pgn) || alloc_frame_may_oom(caller, fpn) < 0)
+            return -1;
+
+        MEMPHY_zero_frame(caller->mram, *fpn);
+        pte_set_fpn(&mm->pgd[pgn], *fpn);
+        MEMPHY_put_usedfp(caller->mram, *fpn, mm, pgn);
+        loadctl_touch(mm, caller->mram, *fpn, 1);
+        return 0;
     }
-    if (pte & PAGING_PTE_SWAPPED_MASK) {
+    if (PAGING_PAGE_SWAPPED(pte) && PAGING_PTE_SWPTYP(pte) == PAGING_SWPTYP_SHM) {
+        int fault = shm_getpage(caller, mm, pgn, fpn);
+
+        if (fault < 0)
+            return -1;
+        loadctl_touch(mm, caller->mram, *fpn, fault);
+        return 0;
+    }
+    if (PAGING_PAGE_SWAPPED(pte)) {
         /* Page is not online, make it actively living */
-        int vicpgn, swpfpn;
         int vicfpn;
-        uint32_t vicpte;
-
-        int tgtfpn = PAGING_SWP(pte); // The target frame storing our variable
-
-        /* TODO: Play with your paging theory here */
-        /* Find victim page */
-        if (find_victim_page(caller->mm, &vicpgn) == 0) {
-            vicpte = caller->mm->pgd[vicpgn];
-            vicfpn = PAGING_FPN(vicpte);
-            /* Remove frame from used_fp_list */
-            MEMPHY_remove_usedfp(caller->mram, vicfpn);
-            /* Get free frame in MEMSWP */
-            MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
-
-            /* Do swap frame from MEMRAM to MEMSWP and vice versa */
-            /* Copy victim frame to swap */
-            __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
-            /* Copy target frame from swap to mem */
-            __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, vicfpn);
-
-            /* Update page table */
-            pte_set_swap(&caller->mm->pgd[vicpgn], 0, swpfpn);
-
-            /* Update its online status of the target page */
-            pte_set_fpn(&caller->mm->pgd[pgn], vicfpn);
-            enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
-            MEMPHY_put_usedfp(caller->mram, vicfpn, caller->mm);
-            *fpn = vicfpn;
-        } else {
-            /* Get global frame */
-            struct framephy_struct *fp = MEMPHY_get_usedfp(caller->mram);
-            find_victim_page(fp->owner, &vicpgn);
-            vicpte = fp->owner->pgd[vicpgn];
-            vicfpn = PAGING_FPN(vicpte);
-            /* Get free frame in MEMSWP */
-            MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
-            /* Copy victim frame to swap */
-            __swap_cp_page(caller->mram, fp->fpn, caller->active_mswp, swpfpn);
-            /* Copy target frame from swap to mem */
-            __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, vicfpn);
-
-            /* Update page table */
-            pte_set_swap(&fp->owner->pgd[vicpgn], 0, swpfpn);
-
-            /* Update its online status of the target page */
-            pte_set_fpn(&caller->mm->pgd[pgn], vicfpn);
-            enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
-            MEMPHY_put_usedfp(caller->mram, vicfpn, caller->mm);
-            *fpn = vicfpn;
+
+        /* Get a frame in MEMRAM, swapping a victim out if none is free */
+        if (alloc_frame_may_oom(caller, &vicfpn) < 0)
+            return -1;
+
+        /* Copy it in from the swap cache or the device it was (possibly
+         * demoted to while making room) */
+        pte = mm->pgd[pgn];
+        if (swap_in_page(caller, pte, vicfpn) < 0) {
+            MEMPHY_put_freefp(caller->mram, vicfpn);
+            memcg_charge(mm, -1, 0);
+            return -1;
         }
+        memcg_charge(mm, 0, -1);
+
+        /* Sequential sweeps find their next pages already online. Done
+         * while our frame is off every list, so it cannot be evicted */
+        swap_readahead(caller, mm, pgn, pte);
+
+        /* Update its online status of the target page */
+        pte_set_fpn(&mm->pgd[pgn], vicfpn);
+        MEMPHY_put_usedfp(caller->mram, vicfpn, mm, pgn);
+        *fpn = vicfpn;
+        loadctl_touch(mm, caller->mram, *fpn, 1);
     } else {
-        *fpn = PAGING_FPN(pte);
+        *fpn = PAGING_PTE_FPN(pte);
+        swap_ra_touch(caller->mram, *fpn, 1);
+        loadctl_touch(mm, caller->mram, *fpn, 0);
     }
     return 0;
 }
@@ -269,7 +446,7 @@ int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller) {
  *@value: value
  *
  */
-int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
+int pg_getval(struct mm_struct *mm, addr_t addr, BYTE *data, struct pcb_t *caller)
 {
   int pgn = PAGING_PGN(addr);
   int off = PAGING_OFFST(addr);
@@ -292,7 +469,7 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
  *@value: value
  *
  */
-int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
+int pg_setval(struct mm_struct *mm, addr_t addr, BYTE value, struct pcb_t *caller)
 {
   int pgn = PAGING_PGN(addr);
   int off = PAGING_OFFST(addr);
@@ -302,8 +479,22 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
   if(pg_getpage(mm, pgn, &fpn, caller) != 0) 
     return -1; /* invalid page access */
 
+  /* A merged page is copied before it is written */
+  if ((mm->pgd[pgn] & PAGING_PTE_COW_MASK) &&
+      ksm_break_cow(caller, mm, pgn, &fpn) != 0)
+    return -1;
+
   int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
 
+  /* First write since swap-in, the swap copy goes stale */
+  if (!(mm->pgd[pgn] & PAGING_PTE_DIRTY_MASK)) {
+    SETBIT(mm->pgd[pgn], PAGING_PTE_DIRTY_MASK);
+    if (mm->pgd[pgn] & PAGING_PTE_SHARED_MASK)
+      shm_drop_copy(caller, fpn);
+    else
+      swap_drop_copy(caller, fpn);
+  }
+
   MEMPHY_write(caller->mram,phyaddr, value);
 
    return 0;
@@ -319,21 +510,34 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
  */
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data)
 {
+  int ret;
+
+  pthread_mutex_lock(&caller->mm->lock);
+  if (caller->mm->oom_killed) {
+    pthread_mutex_unlock(&caller->mm->lock);
+    return -1;
+  }
+
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
-  if(currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+  if(currg == NULL || cur_vma == NULL || currg->vmaid != vmaid) /* Invalid memory identify */
+  {
+	  pthread_mutex_unlock(&caller->mm->lock);
 	  return -1;
+  }
 
   if(currg->rg_start + offset > cur_vma->sbrk) {
   	printf("Offset out of range \n");
+  	pthread_mutex_unlock(&caller->mm->lock);
   	return -1;
   }
 
-  pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  ret = pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  pthread_mutex_unlock(&caller->mm->lock);
 
-  return 0;
+  return ret;
 }
 
 
@@ -345,13 +549,15 @@ int pgread(
 		uint32_t destination) 
 {
   BYTE data;
-  int val = __read(proc, 0, source, offset, &data);
+  int val = __read(proc, get_symrg_vmaid(proc->mm, source), source, offset, &data);
 
   destination = (uint32_t) data;
 #ifdef IODUMP
   printf("read region=%d offset=%d value=%d\n", source, offset, data);
 #ifdef PAGETBL_DUMP
+  pthread_mutex_lock(&proc->mm->lock);
   print_pgtbl(proc, 0, -1); //print max TBL
+  pthread_mutex_unlock(&proc->mm->lock);
 #endif
   MEMPHY_dump(proc->mram);
 #endif
@@ -369,21 +575,34 @@ int pgread(
  */
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value)
 {
+  int ret;
+
+  pthread_mutex_lock(&caller->mm->lock);
+  if (caller->mm->oom_killed) {
+    pthread_mutex_unlock(&caller->mm->lock);
+    return -1;
+  }
+
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
   
-  if(currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+  if(currg == NULL || cur_vma == NULL || currg->vmaid != vmaid) /* Invalid memory identify */
+  {
+	  pthread_mutex_unlock(&caller->mm->lock);
 	  return -1;
+  }
 
   if(currg->rg_start + offset > cur_vma->sbrk) {
   	printf("Offset out of range \n");
+  	pthread_mutex_unlock(&caller->mm->lock);
   	return -1;
   }
 
-  pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  ret = pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  pthread_mutex_unlock(&caller->mm->lock);
 
-  return 0;
+  return ret;
 }
 
 /*pgwrite - PAGING-based write a region memory */
@@ -396,39 +615,68 @@ int pgwrite(
 #ifdef IODUMP
   printf("write region=%d offset=%d value=%d\n", destination, offset, data);
 #ifdef PAGETBL_DUMP
+  pthread_mutex_lock(&proc->mm->lock);
   print_pgtbl(proc, 0, -1); //print max TBL
+  pthread_mutex_unlock(&proc->mm->lock);
 #endif
   MEMPHY_dump(proc->mram);
 #endif
 
-  return __write(proc, 0, destination, offset, data);
+  return __write(proc, get_symrg_vmaid(proc->mm, destination), destination, offset, data);
 }
 
 
+/*release_mm_pages - give back every frame and swap slot of a process
+ *@proc: owner of the mm, held by the caller (own lock or mm_claim)
+ *
+ * Online pages give back their frame, swapped ones their slot, shared
+ * segments are detached. Only the mapped span of each area is walked, no
+ * page lives outside one. Areas and regions stay.
+ */
+int release_mm_pages(struct pcb_t *proc)
+{
+  struct mm_struct *mm = proc->mm;
+  struct vm_area_struct *vma;
+  int i;
+
+  for (i = 0; i < mm->symrgtbl.nr; i++)
+    if (mm->symrgtbl.rg[i].shmid >= 0)
+      shm_detach(proc, &mm->symrgtbl.rg[i]);
+  for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+    release_pgn_range(proc, PAGING_PGN(vma->vm_start),
+                      PAGING_PGN(PAGING_PAGE_ALIGNSZ(vma->vm_end)));
+
+  return 0;
+}
+
 /*free_pcb_memphy - collect all memphy of pcb
  *@caller: caller
- *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+ *
+ * The mm, its areas and regions all go with the owner's arena once
+ * its pages are released, which empties its victim FIFO.
  */
 int free_pcb_memph(struct pcb_t *caller)
 {
-  int pagenum, fpn;
-  uint32_t pte;
+  struct mm_struct *mm = caller->mm;
 
+  if (mm == NULL)
+    return -1;
 
-  for(pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
-  {
-    pte= caller->mm->pgd[pagenum];
-    if (!PAGING_PAGE_PRESENT(pte)) continue;
-    if (!PAGING_PAGE_PRESENT(pte))
-    {
-      fpn = PAGING_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
-    } else {
-      fpn = PAGING_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);    
-    }
-  }
+  /* No longer an OOM victim candidate */
+  oom_unregister(caller);
+
+  /* Held to the end, reclaim on other CPUs backs off this mm */
+  pthread_mutex_lock(&mm->lock);
+  loadctl_exit(caller);
+  release_mm_pages(caller);
+  memcg_detach(mm);
+
+  vm_symtbl_destroy(&mm->symrgtbl);
+  free(mm->pgd);
+  pthread_mutex_unlock(&mm->lock);
+  pthread_mutex_destroy(&mm->lock);
+  mm_arena_release(mm->arena);
+  caller->mm = NULL;
 
   return 0;
 }
@@ -446,7 +694,9 @@ struct vm_rg_struct* get_vm_area_node_at_brk(struct pcb_t *caller, int vmaid, in
   struct vm_rg_struct * newrg;
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
-  newrg = malloc(sizeof(struct vm_rg_struct));
+  newrg = mm_arena_alloc(caller->mm->arena, &vm_rg_cache);
+  if (newrg == NULL)
+    return NULL;
 
   newrg->rg_start = cur_vma->sbrk;
   newrg->rg_end = newrg->rg_start + size;
@@ -461,19 +711,41 @@ struct vm_rg_struct* get_vm_area_node_at_brk(struct pcb_t *caller, int vmaid, in
  *@vmaend: vma end
  *
  */
-int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend) {
-    struct vm_area_struct *vma = caller->mm->mmap;
+int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, addr_t vmastart, addr_t vmaend) {
+    struct vm_area_struct *self = get_vma_by_num(caller->mm, vmaid);
+
+    /* The planned area must fit the CPU address bus */
+    if (vmaend < vmastart || vmaend > PAGING_ADDR_SPACE)
+        return -1;
+
+    /* Validate the planned memory area is not overlapped */
+    if (vma_itree_overlap(caller->mm->vma_itree, vmastart, vmaend, self) != NULL)
+        return -1;
 
-    /* TODO: Validate the planned memory area is not overlapped */
-    while (vma) {
-        if (vma->vm_id != vmaid && vmaend > vma->vm_start && vmastart < vma->vm_end)
-            return -1;
-        else
-            vma = vma->vm_next;
-    }
     return 0;
 }
 
+/*vma_grow - move the break of a vm area up, no page gets mapped
+ *@caller: caller
+ *@vmaid: ID vm area
+ *@inc_sz: increment size
+ *
+ */
+int vma_grow(struct pcb_t *caller, int vmaid, int inc_sz)
+{
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+
+  if (validate_overlap_vm_area(caller, vmaid, cur_vma->sbrk, cur_vma->sbrk + inc_sz) < 0)
+    return -1;
+
+  avl_erase(&caller->mm->vma_itree, &cur_vma->vm_itnode, vma_itree_cmp, vma_itree_augment);
+  cur_vma->vm_end += inc_sz;
+  cur_vma->sbrk += inc_sz;
+  avl_insert(&caller->mm->vma_itree, &cur_vma->vm_itnode, vma_itree_cmp, vma_itree_augment);
+
+  return 0;
+}
+
 /*inc_vma_limit - increase vm area limits to reserve space for new variable
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -482,25 +754,38 @@ int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int
  */
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
 {
-  struct vm_rg_struct * newrg = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct newrg;
   int inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
   int incnumpage =  inc_amt / PAGING_PAGESZ;
   struct vm_rg_struct *area = get_vm_area_node_at_brk(caller, vmaid, inc_sz, inc_amt);
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
-  int old_end = cur_vma->vm_end;
+  addr_t old_end = cur_vma->vm_end;
+  int ret;
+
+  if (area == NULL)
+    return -1;
 
   /*Validate overlap of obtained region */
-  if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0)
+  if (vma_grow(caller, vmaid, inc_sz) < 0) {
+    mm_arena_free(caller->mm->arena, &vm_rg_cache, area);
     return -1; /*Overlap and failed allocation */
+  }
 
   /* The obtained vm area (only) 
    * now will be alloc real ram region */
-  cur_vma->vm_end += inc_sz;
-  cur_vma->sbrk += inc_sz;
-  if (vm_map_ram(caller, area->rg_start, area->rg_end, 
-                    old_end, incnumpage , newrg) < 0)
-    return -1; /* Map the memory to MEMRAM */
+  ret = vm_map_ram(caller, area->rg_start, area->rg_end,
+                   old_end, incnumpage , &newrg); /* Map the memory to MEMRAM */
+  mm_arena_free(caller->mm->arena, &vm_rg_cache, area);
+
+  if (ret < 0) {
+    /* Out of memory, nothing got mapped: the break goes back */
+    avl_erase(&caller->mm->vma_itree, &cur_vma->vm_itnode, vma_itree_cmp, vma_itree_augment);
+    cur_vma->vm_end = old_end;
+    cur_vma->sbrk -= inc_sz;
+    avl_insert(&caller->mm->vma_itree, &cur_vma->vm_itnode, vma_itree_cmp, vma_itree_augment);
+    return -1;
+  }
 
   return 0;
 
@@ -512,28 +797,13 @@ int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
  *
  */
 int find_victim_page(struct mm_struct *mm, int *retpgn) {
-    struct pgn_t *pg = mm->fifo_pgn;
     /* TODO: Implement the theoretical mechanism to find the victim page */
-    if (!pg) {
+    /* The FIFO holds only private pages in MEMRAM, oldest first; the
+     * caller takes the frame off with MEMPHY_remove_usedfp */
+    if (mm->fifo_head == NULL)
         return -1;
-    }
-
-    if (!pg->pg_next) {
-        *retpgn = pg->pgn;
-        free(pg);
-        mm->fifo_pgn = NULL;
-    } else {
-        struct pgn_t *pre = mm->fifo_pgn;
-        while (pre->pg_next->pg_next) {
-            pre = pre->pg_next;
-            pg = pg->pg_next;
-        }
-        pg = pg->pg_next;
-        pre->pg_next = NULL;
-        *retpgn = pg->pgn;
-        free(pg);
-    }
 
+    *retpgn = mm->fifo_head->pgn;
     return 0;
 }
 
@@ -547,59 +817,14 @@ int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_s
 {
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
-  struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
-
-  if (rgit == NULL)
+  if (cur_vma == NULL || size <= 0)
     return -1;
 
   /* Probe unintialized newrg */
   newrg->rg_start = newrg->rg_end = -1;
 
-  /* Traverse on list of free vm region to find a fit space */
-  while (rgit != NULL)
-  {
-    if (rgit->rg_start + size <= rgit->rg_end)
-    { /* Current region has enough space */
-      newrg->rg_start = rgit->rg_start;
-      newrg->rg_end = rgit->rg_start + size;
-
-      /* Update left space in chosen region */
-      if (rgit->rg_start + size < rgit->rg_end)
-      {
-        rgit->rg_start = rgit->rg_start + size;
-      }
-      else
-      { /*Use up all space, remove current node */
-        /*Clone next rg node */
-        struct vm_rg_struct *nextrg = rgit->rg_next;
-
-        /*Cloning */
-        if (nextrg != NULL)
-        {
-          rgit->rg_start = nextrg->rg_start;
-          rgit->rg_end = nextrg->rg_end;
-
-          rgit->rg_next = nextrg->rg_next;
-
-          free(nextrg);
-        }
-        else
-        { /*End of free list */
-          rgit->rg_start = rgit->rg_end;	//dummy, size 0 region
-          rgit->rg_next = NULL;
-        }
-      }
-    }
-    else
-    {
-      rgit = rgit->rg_next;	// Traverse next rg
-    }
-  }
-
- if(newrg->rg_start == -1) // new region not found
-   return -1;
-
- return 0;
+  /* Look up a fit space in the free region index */
+  return vm_freerg_alloc(&cur_vma->vm_freerg, size, VMRG_FIT, newrg);
 }
 
 //#endif
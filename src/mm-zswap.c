@@ -0,0 +1,383 @@
+/*
+ * PAGING based Memory Management
+ * Compressed swap cache mm/mm-zswap.c
+ *
+ * Pages on their way to swap are first offered to a pool of MEMRAM
+ * frames reserved at start up. A page filled with a single byte value
+ * is kept as that byte alone, any other page is LZ compressed and kept
+ * if it shrinks to at most half a page. A swapped PTE names the cache
+ * with SWPTYP PAGING_SWPTYP_ZSWAP and its SWPOFF is the entry ID, so
+ * swap-in from the cache never touches a MEMSWP device.
+ *
+ * Each pool frame is cut into ZSWAP_NCHUNK chunks tracked by a bitmask,
+ * an entry takes a run of chunks within one frame.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define ZSWAP_NCHUNK   16
+#define ZSWAP_CHUNKSZ  (PAGING_PAGESZ / ZSWAP_NCHUNK)
+#define ZSWAP_MAXLEN   (PAGING_PAGESZ / 2)
+
+/* LZ token: 0x00-0x7f literal run of c+1 bytes, 0x80-0xff match of
+ * (c & 0x7f) + LZ_MINMATCH bytes followed by one byte of offset - 1 */
+#define LZ_MINMATCH    3
+#define LZ_MAXMATCH    (0x7f + LZ_MINMATCH)
+#define LZ_MAXLIT      0x80
+#define LZ_MAXOFF      256
+#define LZ_HASHSZ      256
+
+struct zswap_entry {
+   int frame;          /* pool frame index, -1 for a same-filled page */
+   short chunk;        /* first chunk in the frame */
+   int len;            /* compressed length */
+   BYTE fill;          /* value of a same-filled page */
+   int refcnt;         /* 0: entry ID is free */
+   int next_free;
+};
+
+static struct {
+   struct memphy_struct *mram;
+   int *fpn;                    /* reserved frames */
+   unsigned short *chunkmap;    /* used chunks per frame */
+   int nframe;
+
+   struct zswap_entry *ent;
+   int nent, cap;
+   int free_ent;
+
+   unsigned long stored, same_filled, rejected, loads;
+   pthread_mutex_t lock;
+} zpool = { .lock = PTHREAD_MUTEX_INITIALIZER, .free_ent = -1 };
+
+/* Page being compressed or expanded and its compressed form, per thread */
+static __thread BYTE zswap_page[PAGING_MAX_PAGESZ];
+static __thread BYTE zswap_buf[PAGING_MAX_PAGESZ / 2];
+
+/*
+ *  lz_compress - compress a page, give up once the output exceeds max
+ */
+static int lz_compress(const BYTE *in, int len, BYTE *out, int max)
+{
+   int head[LZ_HASHSZ];
+   int ip = 0, op = 0, lit = 0, litpos = 0, h, ref = -1, mlen;
+
+   memset(head, 0xff, sizeof(head));
+
+   while (ip < len)
+   {
+     mlen = 0;
+     if (ip + LZ_MINMATCH <= len)
+     {
+       h = ((unsigned char)in[ip] * 33 + (unsigned char)in[ip + 1] * 7 +
+            (unsigned char)in[ip + 2]) & (LZ_HASHSZ - 1);
+       ref = head[h];
+       head[h] = ip;
+       if (ref >= 0 && ip - ref <= LZ_MAXOFF)
+         while (ip + mlen < len && mlen < LZ_MAXMATCH && in[ref + mlen] == in[ip + mlen])
+           mlen++;
+     }
+
+     if (mlen < LZ_MINMATCH)
+     {
+       /* Extend the pending literal run, its token is patched last */
+       if (lit == 0)
+       {
+         if (op + 2 > max)
+           return -1;
+         litpos = op++;
+       } else if (op >= max)
+         return -1;
+       out[op++] = in[ip++];
+       out[litpos] = lit++;
+       if (lit == LZ_MAXLIT)
+         lit = 0;
+       continue;
+     }
+
+     if (op + 2 > max)
+       return -1;
+     out[op++] = (BYTE)(0x80 | (mlen - LZ_MINMATCH));
+     out[op++] = (BYTE)(ip - ref - 1);
+     ip += mlen;
+     lit = 0;
+   }
+
+   return op;
+}
+
+/*
+ *  lz_decompress - expand a page compressed by lz_compress
+ */
+static int lz_decompress(const BYTE *in, int len, BYTE *out, int max)
+{
+   int ip = 0, op = 0, n, off;
+   unsigned char c;
+
+   while (ip < len)
+   {
+     c = in[ip++];
+     if (c < 0x80)
+     {
+       n = c + 1;
+       if (ip + n > len || op + n > max)
+         return -1;
+       memcpy(out + op, in + ip, n);
+       ip += n;
+     } else {
+       n = (c & 0x7f) + LZ_MINMATCH;
+       if (ip >= len)
+         return -1;
+       off = (unsigned char)in[ip++] + 1;
+       if (off > op || op + n > max)
+         return -1;
+       /* Byte by byte, a match may overlap its own output */
+       while (n-- > 0)
+       {
+         out[op] = out[op - off];
+         op++;
+       }
+       continue;
+     }
+     op += n;
+   }
+
+   return op;
+}
+
+/*
+ *  zswap_init - reserve a compressed swap cache in MEMRAM
+ *  @mram: RAM device the pool is carved from
+ *  @pct: share of the RAM frames, in percent
+ */
+int zswap_init(struct memphy_struct *mram, int pct)
+{
+   int want = (mram->maxsz / PAGING_PAGESZ) * pct / 100;
+   int i;
+
+   if (want <= 0)
+     return -1;
+
+   zpool.fpn = malloc(want * sizeof(int));
+   zpool.chunkmap = calloc(want, sizeof(unsigned short));
+   if (zpool.fpn == NULL || zpool.chunkmap == NULL)
+     return -1;
+
+   for (i = 0; i < want; i++)
+     if (MEMPHY_get_freefp(mram, &zpool.fpn[i]) < 0)
+       break;
+
+   zpool.nframe = i;
+   zpool.mram = mram;
+   return 0;
+}
+
+/*
+ *  zswap_get_entry - new entry ID, caller holds zpool.lock
+ */
+static int zswap_get_entry(void)
+{
+   struct zswap_entry *ent;
+   int id;
+
+   if (zpool.free_ent >= 0)
+   {
+     id = zpool.free_ent;
+     zpool.free_ent = zpool.ent[id].next_free;
+     return id;
+   }
+
+   if (zpool.nent == zpool.cap)
+   {
+     ent = realloc(zpool.ent, (zpool.cap ? 2 * zpool.cap : 64) * sizeof(*ent));
+     if (ent == NULL)
+       return -1;
+     zpool.ent = ent;
+     zpool.cap = zpool.cap ? 2 * zpool.cap : 64;
+   }
+
+   return zpool.nent++;
+}
+
+/*
+ *  zswap_get_chunks - find nchunk free chunks in one pool frame,
+ *  caller holds zpool.lock
+ */
+static int zswap_get_chunks(int nchunk, int *frame, int *chunk)
+{
+   unsigned int run = (1U << nchunk) - 1;
+   int i, c;
+
+   for (i = 0; i < zpool.nframe; i++)
+     for (c = 0; c + nchunk <= ZSWAP_NCHUNK; c++)
+       if ((zpool.chunkmap[i] & (run << c)) == 0)
+       {
+         zpool.chunkmap[i] |= run << c;
+         *frame = i;
+         *chunk = c;
+         return 0;
+       }
+
+   return -1;
+}
+
+/*
+ *  zswap_store - keep a RAM frame compressed in the cache
+ *  @mram: RAM device holding the page
+ *  @fpn: frame of the page
+ *  @id: entry ID, the SWPOFF of the swapped PTE
+ */
+int zswap_store(struct memphy_struct *mram, int fpn, int *id)
+{
+   BYTE *page = zswap_page, *buf = zswap_buf;
+   struct zswap_entry *e;
+   int len = 0, i, frame = -1, chunk = 0;
+
+   if (zpool.mram == NULL || mram != zpool.mram)
+     return -1;
+
+   MEMPHY_read_block(mram, fpn * PAGING_PAGESZ, page, PAGING_PAGESZ);
+
+   for (i = 1; i < PAGING_PAGESZ && page[i] == page[0]; i++);
+   if (i < PAGING_PAGESZ &&
+       (len = lz_compress(page, PAGING_PAGESZ, buf, ZSWAP_MAXLEN)) < 0)
+   {
+     __sync_fetch_and_add(&zpool.rejected, 1);
+     return -1;
+   }
+
+   pthread_mutex_lock(&zpool.lock);
+   if ((len > 0 && zswap_get_chunks((len + ZSWAP_CHUNKSZ - 1) / ZSWAP_CHUNKSZ,
+                                    &frame, &chunk) < 0) ||
+       (*id = zswap_get_entry()) < 0)
+   {
+     if (frame >= 0)
+       zpool.chunkmap[frame] &= ~(((1U << ((len + ZSWAP_CHUNKSZ - 1) / ZSWAP_CHUNKSZ)) - 1) << chunk);
+     zpool.rejected++;
+     pthread_mutex_unlock(&zpool.lock);
+     return -1;
+   }
+
+   e = &zpool.ent[*id];
+   e->frame = frame;
+   e->chunk = chunk;
+   e->len = len;
+   e->fill = page[0];
+   e->refcnt = 1;
+   zpool.stored++;
+   if (len == 0)
+     zpool.same_filled++;
+   pthread_mutex_unlock(&zpool.lock);
+
+   if (len > 0)
+     MEMPHY_write_block(mram, zpool.fpn[frame] * PAGING_PAGESZ + chunk * ZSWAP_CHUNKSZ,
+                        buf, len);
+
+   return 0;
+}
+
+/*
+ *  zswap_load - expand a cache entry into a RAM frame
+ *  @id: entry ID
+ *  @fpn: destination frame in the cache's RAM device
+ */
+int zswap_load(int id, int fpn)
+{
+   BYTE *page = zswap_page, *buf = zswap_buf;
+   struct zswap_entry e;
+
+   pthread_mutex_lock(&zpool.lock);
+   if (id < 0 || id >= zpool.nent || zpool.ent[id].refcnt == 0)
+   {
+     pthread_mutex_unlock(&zpool.lock);
+     return -1;
+   }
+   e = zpool.ent[id];
+   zpool.loads++;
+   pthread_mutex_unlock(&zpool.lock);
+
+   if (e.len == 0)
+     memset(page, e.fill, PAGING_PAGESZ);
+   else {
+     MEMPHY_read_block(zpool.mram, zpool.fpn[e.frame] * PAGING_PAGESZ +
+                       e.chunk * ZSWAP_CHUNKSZ, buf, e.len);
+     if (lz_decompress(buf, e.len, page, PAGING_PAGESZ) != PAGING_PAGESZ)
+       return -1;
+   }
+
+   return MEMPHY_write_block(zpool.mram, fpn * PAGING_PAGESZ, page, PAGING_PAGESZ);
+}
+
+/*
+ *  zswap_dup - take another reference on a cache entry
+ *  @id: entry ID
+ */
+int zswap_dup(int id)
+{
+   int ret = -1;
+
+   pthread_mutex_lock(&zpool.lock);
+   if (id >= 0 && id < zpool.nent && zpool.ent[id].refcnt > 0)
+   {
+     zpool.ent[id].refcnt++;
+     ret = 0;
+   }
+   pthread_mutex_unlock(&zpool.lock);
+
+   return ret;
+}
+
+/*
+ *  zswap_put - drop a reference on a cache entry
+ *  @id: entry ID
+ *
+ *  Return the references left, the entry's chunks are free once it is 0
+ */
+int zswap_put(int id)
+{
+   struct zswap_entry *e;
+   int ret = -1, nchunk;
+
+   pthread_mutex_lock(&zpool.lock);
+   if (id >= 0 && id < zpool.nent && zpool.ent[id].refcnt > 0)
+   {
+     e = &zpool.ent[id];
+     ret = --e->refcnt;
+     if (ret == 0)
+     {
+       if (e->len > 0)
+       {
+         nchunk = (e->len + ZSWAP_CHUNKSZ - 1) / ZSWAP_CHUNKSZ;
+         zpool.chunkmap[e->frame] &= ~(((1U << nchunk) - 1) << e->chunk);
+       }
+       e->next_free = zpool.free_ent;
+       zpool.free_ent = id;
+       zpool.stored--;
+       if (e->len == 0)
+         zpool.same_filled--;
+     }
+   }
+   pthread_mutex_unlock(&zpool.lock);
+
+   return ret;
+}
+
+/*
+ *  zswap_dump - print the cache statistics, if the cache is enabled
+ */
+int zswap_dump(void)
+{
+   if (zpool.mram == NULL)
+     return -1;
+
+   pthread_mutex_lock(&zpool.lock);
+   printf("zswap: %d frames, %lu pages stored (%lu same-filled), %lu rejected, %lu loads\n",
+          zpool.nframe, zpool.stored, zpool.same_filled, zpool.rejected, zpool.loads);
+   pthread_mutex_unlock(&zpool.lock);
+
+   return 0;
+}
@@ -6,11 +6,55 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+
+struct paging_geom paging = {
+  .pagesz = PAGING_DEFAULT_PAGESZ,
+  .page_shift = NBITS(PAGING_DEFAULT_PAGESZ),
+  .offst_mask = PAGING_DEFAULT_PAGESZ - 1,
+  .pgn_mask = GENMASK_ULL(PAGING_DEFAULT_BUS_WIDTH - 1, NBITS(PAGING_DEFAULT_PAGESZ)),
+  .bus_width = PAGING_DEFAULT_BUS_WIDTH,
+  .max_pgn = BIT(PAGING_DEFAULT_BUS_WIDTH) / PAGING_DEFAULT_PAGESZ,
+  .pte_fpn_mask = PTE_GENMASK(12, 0),
+};
+
+/*
+ * paging_setup - derive the paging geometry, before any device exists
+ * @pagesz   : page size, a power of two
+ * @bus_width: address bits
+ * @ramsz    : MEMRAM size, its frames set the width of the PTE FPN field
+ */
+int paging_setup(int pagesz, int bus_width, int ramsz)
+{
+  int shift = NBITS(pagesz), fpnbits = 1;
+
+  if (pagesz < PAGING_MIN_PAGESZ || pagesz > PAGING_MAX_PAGESZ ||
+      (pagesz & (pagesz - 1)) != 0 || bus_width > PAGING_MAX_BUS_WIDTH ||
+      bus_width - shift > PAGING_MAX_PGN_BITS ||
+      BIT_ULL(bus_width) / PAGING_MAX_VMA < pagesz)
+    return -1;
+
+  while (fpnbits < PAGING_PTE_FPN_MAXBITS && BIT_ULL(fpnbits) < ramsz / pagesz)
+    fpnbits++;
+  if (BIT_ULL(fpnbits) < ramsz / pagesz)
+    return -1;
+
+  paging.pagesz = pagesz;
+  paging.page_shift = shift;
+  paging.offst_mask = pagesz - 1;
+  paging.pgn_mask = GENMASK_ULL(bus_width - 1, shift);
+  paging.bus_width = bus_width;
+  paging.max_pgn = BIT(bus_width - shift);
+  paging.pte_fpn_mask = PTE_GENMASK(fpnbits - 1, PAGING_PTE_FPN_LOBIT);
+
+  return 0;
+}
+
 #ifdef MM_PAGING
 /* 
  * init_pte - Initialize PTE entry
  */
-int init_pte(uint32_t *pte,
+int init_pte(pte_t *pte,
              int pre,    // present
              int fpn,    // FPN
              int drt,    // dirty
@@ -28,14 +72,14 @@ int init_pte(uint32_t *pte,
       CLRBIT(*pte, PAGING_PTE_SWAPPED_MASK);
       CLRBIT(*pte, PAGING_PTE_DIRTY_MASK);
 
-      SETVAL(*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT); 
+      SETVAL(*pte, (pte_t)fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT); 
     } else { // page swapped
       SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
       SETBIT(*pte, PAGING_PTE_SWAPPED_MASK);
       CLRBIT(*pte, PAGING_PTE_DIRTY_MASK);
 
-      SETVAL(*pte, swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT); 
-      SETVAL(*pte, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+      SETVAL(*pte, (pte_t)swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT); 
+      SETVAL(*pte, (pte_t)swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
     }
   }
 
@@ -48,13 +92,14 @@ int init_pte(uint32_t *pte,
  * @swptyp : swap type
  * @swpoff : swap offset
  */
-int pte_set_swap(uint32_t *pte, int swptyp, int swpoff)
+int pte_set_swap(pte_t *pte, int swptyp, int swpoff)
 {
   SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
   SETBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+  CLRBIT(*pte, PAGING_PTE_DIRTY_MASK);
 
-  SETVAL(*pte, swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
-  SETVAL(*pte, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+  SETVAL(*pte, (pte_t)swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
+  SETVAL(*pte, (pte_t)swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
 
   return 0;
 }
@@ -64,12 +109,14 @@ int pte_set_swap(uint32_t *pte, int swptyp, int swpoff)
  * @pte   : target page table entry (PTE)
  * @fpn   : frame page number (FPN)
  */
-int pte_set_fpn(uint32_t *pte, int fpn)
+int pte_set_fpn(pte_t *pte, int fpn)
 {
   SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
   CLRBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+  CLRBIT(*pte, PAGING_PTE_DIRTY_MASK);
+  CLRBIT(*pte, PAGING_PTE_SWPOFF_MASK);
 
-  SETVAL(*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT); 
+  SETVAL(*pte, (pte_t)fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT); 
 
   return 0;
 }
@@ -79,7 +126,7 @@ int pte_set_fpn(uint32_t *pte, int fpn)
  * vmap_page_range - map a range of page at aligned address
  */
 int vmap_page_range(struct pcb_t *caller, // process call
-                                int addr, // start address which is aligned to pagesz
+                             addr_t addr, // start address which is aligned to pagesz
                                int pgnum, // num of mapping page
            struct framephy_struct *frames,// list of the mapped frames
               struct vm_rg_struct *ret_rg)// return mapped region, the real mapped fp
@@ -98,11 +145,12 @@ int vmap_page_range(struct pcb_t *caller, // process call
    *      [addr to addr + pgnum*PAGING_PAGESZ
    *      in page table caller->mm->pgd[]
    */
-  for (; pgit < pgnum; pgit++){
+  for (; pgit < pgnum && frames != NULL; pgit++){
+    struct framephy_struct *next = frames->fp_next;
+
     pte_set_fpn(&caller->mm->pgd[pgn + pgit], frames->fpn);
-    MEMPHY_put_usedfp(caller->mram, frames->fpn, caller->mm);
-    frames = frames->fp_next;
-    enlist_pgn_node(&caller->mm->fifo_pgn, pgn+pgit);
+    MEMPHY_put_usedfp(caller->mram, frames->fpn, caller->mm, pgn + pgit);
+    frames = next;
      
   }
    /* Tracking for later page replacement activities (if needed)
@@ -110,84 +158,247 @@ int vmap_page_range(struct pcb_t *caller, // process call
   return 0;
 }
 
+/*
+ * swap_out_frame - swap out a victim page taken off the used list
+ * @caller : caller
+ * @vicmm  : owner of the page, held or claimed
+ * @vicpgn : page number
+ * @vicfpn : frame holding it
+ * @retfpn : the released frame
+ */
+static int swap_out_frame(struct pcb_t *caller, struct mm_struct *vicmm,
+                          int vicpgn, int vicfpn, int *retfpn)
+{
+  int ret = 0;
+
+  swap_ra_touch(caller->mram, vicfpn, 0);
+
+  /* Copy victim frame to the swap cache or a swap device */
+  if (swap_out_page(caller, vicmm, vicpgn, vicfpn) < 0) {
+    /* Nowhere to put it, the victim stays online */
+    MEMPHY_put_usedfp(caller->mram, vicfpn, vicmm, vicpgn);
+    ret = -1;
+  }
+
+  mm_unclaim(vicmm, caller->mm);
+  if (ret == 0)
+    *retfpn = vicfpn;
+  return ret;
+}
+
+/*
+ * swap_out_victim - make room in MEMRAM by moving a victim page to swap
+ * @caller : caller
+ * @retfpn : the released frame, detached from every list
+ *
+ * The victim comes from the caller's own FIFO first, otherwise the
+ * globally oldest used frame is taken; a caller without mm (the reclaim
+ * daemon) always takes the global one. The frame table records which
+ * page of which mm the frame backs, so the right PTE is updated. The
+ * caller holds its own mm lock, a global victim's mm is claimed for the
+ * time of the swap-out. A shared victim leaves all its sharers at once.
+ * Pages of a group at its swap limit are passed over.
+ */
+int swap_out_victim(struct pcb_t *caller, int *retfpn)
+{
+  int vicpgn, vicfpn, retry;
+  struct framephy_struct *fp;
+
+  /* Find victim page */
+  if (caller->mm != NULL && memcg_room(caller->mm, MEMCG_SWP) > 0 &&
+      find_victim_page(caller->mm, &vicpgn) == 0) {
+    vicfpn = PAGING_PTE_FPN(caller->mm->pgd[vicpgn]);
+    MEMPHY_remove_usedfp(caller->mram, vicfpn);
+    return swap_out_frame(caller, caller->mm, vicpgn, vicfpn, retfpn);
+  }
+
+  /* Get global frame, owners busy in their own faults are passed over */
+  for (retry = 0; ; retry++) {
+    fp = MEMPHY_get_usedfp(caller->mram, caller->mm, NULL);
+    if (fp != NULL && !(fp->flags & FRAME_SHM))
+      break;
+    if (fp != NULL && shm_swap_out(caller, fp) == 0) {
+      *retfpn = fp->fpn;
+      return 0;
+    }
+    if (caller->mram->used_fp_list == NULL || retry == MM_CLAIM_RETRY)
+      return -1;
+  }
+
+  return swap_out_frame(caller, fp->owner, fp->pgn, fp->fpn, retfpn);
+}
+
+/*
+ * swap_out_local - make room for a process at its resident limit
+ * @caller : caller, holding its mm lock
+ * @retfpn : the released frame
+ *
+ * The victim is the oldest page of the caller's own FIFO, then the
+ * oldest used frame of another member of its group.
+ */
+int swap_out_local(struct pcb_t *caller, int *retfpn)
+{
+  struct mm_struct *mm = caller->mm;
+  struct framephy_struct *fp = NULL;
+  int vicpgn, vicfpn, retry, ret;
+
+  if (mm->memcg == NULL || memcg_room(mm, MEMCG_SWP) <= 0)
+    return -1;
+
+  if (find_victim_page(mm, &vicpgn) == 0) {
+    vicfpn = PAGING_PTE_FPN(mm->pgd[vicpgn]);
+    MEMPHY_remove_usedfp(caller->mram, vicfpn);
+    ret = swap_out_frame(caller, mm, vicpgn, vicfpn, retfpn);
+  } else {
+    for (retry = 0; fp == NULL && retry < MM_CLAIM_RETRY; retry++)
+      fp = MEMPHY_get_usedfp(caller->mram, mm, mm->memcg);
+    ret = (fp != NULL) ? swap_out_frame(caller, fp->owner, fp->pgn, fp->fpn, retfpn) : -1;
+  }
+
+  if (ret == 0)
+    __sync_fetch_and_add(&mm->memcg->reclaims, 1);
+  return ret;
+}
+
+/*
+ * alloc_frame - get one frame of MEMRAM, swapping out a victim if needed
+ * @caller : caller
+ * @retfpn : obtained frame
+ */
+int alloc_frame(struct pcb_t *caller, int *retfpn)
+{
+  if (MEMPHY_get_freefp(caller->mram, retfpn) == 0)
+    return 0;
+
+  return swap_out_victim(caller, retfpn);
+}
+
+/*
+ * swap_out_mm - move the private pages of a process out of MEMRAM
+ * @caller : context with the devices, its mm holds the pages and is held
+ * @nr     : pages at most
+ *
+ * Pages go in FIFO order while swap takes them, their frames are freed.
+ * Return the number of frames given back.
+ */
+int swap_out_mm(struct pcb_t *caller, int nr)
+{
+  struct mm_struct *mm = caller->mm;
+  int n, vicpgn, vicfpn;
+
+  for (n = 0; n < nr && memcg_room(mm, MEMCG_SWP) > 0; n++) {
+    if (find_victim_page(mm, &vicpgn) < 0)
+      break;
+    vicfpn = PAGING_PTE_FPN(mm->pgd[vicpgn]);
+    MEMPHY_remove_usedfp(caller->mram, vicfpn);
+    if (swap_out_frame(caller, mm, vicpgn, vicfpn, &vicfpn) < 0)
+      break;
+    MEMPHY_put_freefp(caller->mram, vicfpn);
+  }
+
+  return n;
+}
+
+/*
+ * alloc_frame_charged - get a frame for a private page of the caller,
+ * charged to its resident limit: at the limit the caller's group makes
+ * room (swap_out_local), else alloc_frame
+ * @caller : caller
+ * @retfpn : obtained frame, uncharged with memcg_charge if given back
+ */
+static int alloc_frame_charged(struct pcb_t *caller, int *retfpn)
+{
+  for (;;) {
+    if (memcg_try_charge(caller->mm, MEMCG_RSS) == 0) {
+      if (alloc_frame(caller, retfpn) == 0)
+        return 0;
+      memcg_charge(caller->mm, -1, 0);
+      return -1;
+    }
+
+    if (swap_out_local(caller, retfpn) < 0) {
+      __sync_fetch_and_add(&caller->mm->memcg->failures, 1);
+      return -1;
+    }
+
+    /* Another member may have taken the room made meanwhile */
+    if (memcg_try_charge(caller->mm, MEMCG_RSS) == 0)
+      return 0;
+    MEMPHY_put_freefp(caller->mram, *retfpn);
+  }
+}
+
+/*
+ * alloc_frame_may_oom - alloc_frame_charged, calling the OOM killer once
+ * no room can be made; the caller holds its own mm lock and nothing else
+ * @caller : caller
+ * @retfpn : obtained frame, uncharged with memcg_charge if given back
+ */
+int alloc_frame_may_oom(struct pcb_t *caller, int *retfpn)
+{
+  while (alloc_frame_charged(caller, retfpn) < 0)
+    if (oom_kill(caller) < 0)
+      return -1;
+
+  return 0;
+}
+
+/*
+ * free_pages_range - give back the frames of an unmapped frame list
+ * @caller    : caller
+ * @frm_lst   : frame list, emptied
+ */
+static void free_pages_range(struct pcb_t *caller, struct framephy_struct **frm_lst)
+{
+  struct framephy_struct *fp;
+
+  while ((fp = *frm_lst) != NULL) {
+    *frm_lst = fp->fp_next;
+    MEMPHY_put_freefp(caller->mram, fp->fpn);
+    memcg_charge(caller->mm, -1, 0);
+  }
+}
+
 /* 
  * alloc_pages_range - allocate req_pgnum of frame in ram
  * @caller    : caller
  * @req_pgnum : request page num
- * @frm_lst   : frame list
+ * @frm_lst   : frame list, chained through the frame table entries
+ *
+ * A range MEMRAM can never hold at once fails up front. The frames
+ * obtained so far are given back before the OOM killer runs, they may
+ * be all it would find, and the range is then started over.
  */
 
 int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struct** frm_lst)
 {
   int pgit, fpn;
-  struct framephy_struct *newfp_str;
+  struct framephy_struct *newfp_str, *tail = NULL;
+
+  *frm_lst = NULL;
+  if (req_pgnum > caller->mram->maxfpn)
+    return -3000;
 
   for(pgit = 0; pgit < req_pgnum; pgit++)
   {
-    if(MEMPHY_get_freefp(caller->mram, &fpn) == 0) {
-      if ( pgit == 0){
-        newfp_str = malloc(sizeof(struct framephy_struct));
-        newfp_str->owner = caller->mm;
-        newfp_str->fpn = fpn;
-        newfp_str->fp_next = NULL;
-        *frm_lst = newfp_str;
-      }
-      else {
-        newfp_str->fp_next = malloc(sizeof(struct framephy_struct));
-        newfp_str->fp_next->owner = caller->mm;
-        newfp_str->fp_next->fpn = fpn;
-        newfp_str->fp_next->fp_next = NULL;
-        newfp_str = newfp_str->fp_next;
-      }
-        
-    } 
-    else {  // ERROR CODE of obtaining somes but not enough frames
-      int vicpgn, swpfpn;
-      int vicfpn;
-      uint32_t vicpte;
-      /* Find victim page */
-      if (find_victim_page(caller->mm, &vicpgn) == 0) {
-        vicpte = caller->mm->pgd[vicpgn];
-        vicfpn = PAGING_FPN(vicpte);
-        /* Remove frame from used_fp_list*/
-        MEMPHY_remove_usedfp(caller->mram, vicfpn);
-        /* Get free frame in MEMSWP */
-        MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
-        /* Copy victim frame to swap */
-        __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
-        pte_set_swap(&caller->mm->pgd[vicpgn], 0, swpfpn);
-      } 
-      else {
-        /*Get global frame*/
-        struct framephy_struct *fp = MEMPHY_get_usedfp(caller->mram);
-        find_victim_page(fp->owner, &vicpgn);
-        vicpte = fp->owner->pgd[vicpgn];
-        vicfpn = PAGING_FPN(vicpte);
-        //Testing validity
-        /* Get free frame in MEMSWP */
-        MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
-        /* Copy victim frame to swap */
-        __swap_cp_page(caller->mram, fp->fpn, caller->active_mswp, swpfpn);
-        pte_set_swap(&fp->owner->pgd[vicpgn], 0, swpfpn);
-      }
-      if ( pgit == 0){
-        newfp_str = malloc(sizeof(struct framephy_struct));
-        newfp_str->owner = caller->mm;
-        newfp_str->fpn = vicfpn;
-        newfp_str->fp_next = NULL;
-        *frm_lst = newfp_str;
-      }
-      else {
-        while (newfp_str->fp_next) {
-          newfp_str = newfp_str ->fp_next;
-        }
-        newfp_str->fp_next = malloc(sizeof(struct framephy_struct));
-        newfp_str->fp_next->owner = caller->mm;
-        newfp_str->fp_next->fpn = vicfpn;
-        newfp_str->fp_next->fp_next = NULL;
-        newfp_str = *frm_lst;
-      }
-   }
+    if (alloc_frame_charged(caller, &fpn) < 0) {
+      /* Out of memory, give back the frames obtained so far */
+      free_pages_range(caller, frm_lst);
+      tail = NULL;
+      pgit = -1;
+      if (oom_kill(caller) < 0)
+        return -3000;
+      continue;
+    }
+
+    newfp_str = MEMPHY_get_frame(caller->mram, fpn);
+    newfp_str->owner = caller->mm;
+    newfp_str->fp_next = NULL;
+    if (tail == NULL)
+      *frm_lst = newfp_str;
+    else
+      tail->fp_next = newfp_str;
+    tail = newfp_str;
   }
   return 0;
 }
@@ -202,10 +413,10 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
  * @incpgnum  : number of mapped page
  * @ret_rg    : returned region
  */
-int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
+int vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t aend, addr_t mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
 {
   struct framephy_struct *frm_lst = NULL;
-  int ret_alloc;
+  int ret_alloc, room;
 
   /*@bksysnet: author provides a feasible solution of getting frames
    *FATAL logic in here, wrong behaviour if we have not enough page
@@ -214,6 +425,11 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
    *in endless procedure of swap-off to get frame and we have not provide 
    *duplicate control mechanism, keep it simple
    */
+  /* Past the resident limit, pages are left to fault in on first touch */
+  room = memcg_room(caller->mm, MEMCG_RSS);
+  if (incpgnum > room)
+    incpgnum = (room > 0) ? room : 0;
+
   ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
 
   if (ret_alloc < 0 && ret_alloc != -3000)
@@ -244,19 +460,8 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn) 
 {
-  int cellidx;
-  int addrsrc,addrdst;
-  for(cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-  {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
-
-    BYTE data;
-    MEMPHY_read(mpsrc, addrsrc, &data);
-    MEMPHY_write(mpdst, addrdst, data);
-  }
-
-  return 0;
+  /* Page granular transfer, no per-byte device calls */
+  return MEMPHY_copy_frame(mpsrc, srcfpn, mpdst, dstfpn);
 }
 
 /*
@@ -266,36 +471,64 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
  */
 int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
-  struct vm_area_struct * vma = malloc(sizeof(struct vm_area_struct));
+  int vmaid;
 
-  mm->pgd = malloc(PAGING_MAX_PGN*sizeof(uint32_t));
+  /* PAGING_MAX_PGN follows the bus width, the table may be large */
+  mm->pgd = calloc(PAGING_MAX_PGN, sizeof(pte_t));
+  if (mm->pgd == NULL)
+    return -1;
+  pthread_mutex_init(&mm->lock, NULL);
+  mm->arena = &caller->arena;
+  mm->fifo_head = mm->fifo_tail = NULL;
+  mm->oom_killed = 0;
+  mm->memcg = NULL;
+  mm->memcg_usage[MEMCG_RSS] = mm->memcg_usage[MEMCG_SWP] = 0;
+  mm->wstat = (struct mm_wstat){ 0 };
+  mm->mmap = NULL;
+  mm->vma_itree = NULL;
+  vm_symtbl_init(&mm->symrgtbl, PAGING_MAX_SYMTBL_SZ);
+  for (vmaid = 0; vmaid < PAGING_MAX_VMA; vmaid++)
+    mm->vmatbl[vmaid] = NULL;
 
   /* By default the owner comes with at least one vma */
-  vma->vm_id = 0;
-  vma->vm_start = 0;
-  vma->vm_end = vma->vm_start;
-  vma->sbrk = vma->vm_start;
-  mm->fifo_pgn = NULL;
-  struct vm_rg_struct *first_rg = init_vm_rg(vma->vm_start, vma->vm_end);
-  enlist_vm_rg_node(&vma->vm_freerg_list, first_rg);
-
-  vma->vm_next = NULL;
-  vma->vm_mm = mm; /*point back to vma owner */
-
-  mm->mmap = vma;
+  if (vma_create(mm, VMA_HEAP) == NULL)
+  {
+    vm_symtbl_destroy(&mm->symrgtbl);
+    pthread_mutex_destroy(&mm->lock);
+    free(mm->pgd);
+    mm->pgd = NULL;
+    return -1;
+  }
 
   return 0;
 }
 
-struct vm_rg_struct* init_vm_rg(int rg_start, int rg_end)
+/*
+ * mm_claim - take the mm of a page reached through a device list
+ * @mm   : owner of the page
+ * @self : mm the caller already holds, NULL for none
+ *
+ * Called with the device lock held, so the owner cannot be torn down
+ * under us. Never blocks: an mm busy elsewhere is reported as -1 and the
+ * caller moves on to another page.
+ */
+int mm_claim(struct mm_struct *mm, struct mm_struct *self)
 {
-  struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
+  if (mm == NULL)
+    return -1;
+  if (mm == self)
+    return 0;
 
-  rgnode->rg_start = rg_start;
-  rgnode->rg_end = rg_end;
-  rgnode->rg_next = NULL;
+  return (pthread_mutex_trylock(&mm->lock) == 0) ? 0 : -1;
+}
 
-  return rgnode;
+/*
+ * mm_unclaim - release an mm taken by mm_claim
+ */
+void mm_unclaim(struct mm_struct *mm, struct mm_struct *self)
+{
+  if (mm != self)
+    pthread_mutex_unlock(&mm->lock);
 }
 
 int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode)
@@ -306,17 +539,6 @@ int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode)
   return 0;
 }
 
-int enlist_pgn_node(struct pgn_t **plist, int pgn)
-{
-  struct pgn_t* pnode = malloc(sizeof(struct pgn_t));
-
-  pnode->pgn = pgn;
-  pnode->pg_next = *plist;
-  *plist = pnode;
-
-  return 0;
-}
-
 int print_list_fp(struct framephy_struct *ifp)
 {
    struct framephy_struct *fp = ifp;
@@ -342,7 +564,7 @@ int print_list_rg(struct vm_rg_struct *irg)
    printf("\n");
    while (rg != NULL)
    {
-       printf("rg[%ld->%ld]\n",rg->rg_start, rg->rg_end);
+       printf("rg[%lu->%lu]\n", (unsigned long)rg->rg_start, (unsigned long)rg->rg_end);
        rg = rg->rg_next;
    }
    printf("\n");
@@ -358,28 +580,14 @@ int print_list_vma(struct vm_area_struct *ivma)
    printf("\n");
    while (vma != NULL )
    {
-       printf("va[%ld->%ld]\n",vma->vm_start, vma->vm_end);
+       printf("va[%lu->%lu]\n", (unsigned long)vma->vm_start, (unsigned long)vma->vm_end);
        vma = vma->vm_next;
    }
    printf("\n");
    return 0;
 }
 
-int print_list_pgn(struct pgn_t *ip)
-{
-   printf("print_list_pgn: ");
-   if (ip == NULL) {printf("NULL list\n"); return -1;}
-   printf("\n");
-   while (ip != NULL )
-   {
-       printf("va[%d]-\n",ip->pgn);
-       ip = ip->pg_next;
-   }
-   printf("n");
-   return 0;
-}
-
-int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
+int print_pgtbl(struct pcb_t *caller, addr_t start, addr_t end)
 {
   int pgn_start,pgn_end;
   int pgit;
@@ -392,14 +600,15 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
   pgn_start = PAGING_PGN(start);
   pgn_end = PAGING_PGN(end);
 
-  printf("print_pgtbl: %d - %d", start, end);
+  printf("print_pgtbl: %lu - %lu", (unsigned long)start, (unsigned long)end);
   if (caller == NULL) {printf("NULL caller\n"); return -1;}
     printf("\n");
 
 
   for(pgit = pgn_start; pgit < pgn_end; pgit++)
   {
-     printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
+     printf("%08ld: %0*lx\n", pgit * sizeof(pte_t), (int)(2 * sizeof(pte_t)),
+            (unsigned long)caller->mm->pgd[pgit]);
   }
 
   return 0;
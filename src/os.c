@@ -21,6 +21,19 @@ static int tlbsz;
 #ifdef MM_PAGING
 static int memramsz;
 static int memswpsz[PAGING_MAX_MMSWP];
+static int memswplat[PAGING_MAX_MMSWP];
+static int zswappct;
+static char memramfile[100];
+static int memrampersist;
+static char memswpfile[PAGING_MAX_MMSWP][100];
+static int memswppersist[PAGING_MAX_MMSWP];
+static int kswapd_low, kswapd_high;
+static struct kswapd_struct kswapd;
+static int ksm_batch;
+static int loadctl_high, loadctl_low;
+static int pagesz = PAGING_DEFAULT_PAGESZ;
+static int buswidth = PAGING_DEFAULT_BUS_WIDTH;
+static int cpus_running;
 
 struct mmpaging_ld_args {
 	/* A dispatched argument struct to compact many-fields passing to loader */
@@ -38,6 +51,11 @@ static struct ld_args{
 #ifdef MLQ_SCHED
 	unsigned long * prio;
 #endif
+#ifdef MM_PAGING
+	int * rss_max;
+	int * swp_max;
+	int * memcg;
+#endif
 } ld_processes;
 int num_processes;
 struct memphy_struct tlb;
@@ -51,16 +69,25 @@ struct cpu_args {
 static void * cpu_routine(void * args) {
 	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
 	int id = ((struct cpu_args*)args)->id;
+#ifdef MM_PAGING
+	/* Page faults on this thread use the CPU's own free frame cache */
+	MEMPHY_bind_cpu(id);
+#endif
 	/* Check for new process in ready queue */
 	int time_left = 0;
 	struct pcb_t * proc = NULL;
 	while (1) {
+#ifdef MM_PAGING
+		/* A process reaped by the OOM killer is retired as finished */
+		if (proc != NULL && oom_killed(proc->mm))
+			proc->pc = proc->code->size;
+#endif
 		/* Check the status of current process */
 		if (proc == NULL) {
 			/* No process is running, the we load new process from
 		 	* ready queue */
 			proc = get_proc();
-			if (proc == NULL) {
+			if (proc == NULL && !done) {
                            next_slot(timer_id);
                            continue; /* First load failed. skip dummy load */
                         }
@@ -68,7 +95,13 @@ static void * cpu_routine(void * args) {
 			/* The porcess has finish it job */
 			printf("\tCPU %d: Processed %2d has finished\n",
 				id ,proc->pid);
-			free(proc);
+#ifdef MM_PAGING
+			free_pcb_memph(proc);
+#endif
+#ifdef CPU_TLB
+			tlb_flush_tlb_of(proc, proc->tlb);
+#endif
+			unload(proc);
 			proc = get_proc();
 			time_left = 0;
 		}else if (time_left == 0) {
@@ -83,6 +116,17 @@ static void * cpu_routine(void * args) {
 		if (proc == NULL && done) {
 			/* No process to run, exit */
 			printf("\tCPU %d stopped\n", id);
+#ifdef MM_PAGING
+			/* The last CPU out lets the memory daemons go */
+			if (__sync_sub_and_fetch(&cpus_running, 1) == 0) {
+				if (kswapd_high > 0)
+					kswapd_stop(&kswapd);
+				if (ksm_batch > 0)
+					ksm_stop();
+				if (loadctl_high > 0)
+					loadctl_stop();
+			}
+#endif
 			break;
 		}else if (proc == NULL) {
 			/* There may be new processes to run in
@@ -100,6 +144,9 @@ static void * cpu_routine(void * args) {
 		time_left--;
 		next_slot(timer_id);
 	}
+#ifdef MM_PAGING
+	kmem_cache_drain();
+#endif
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
@@ -124,11 +171,25 @@ static void * ld_routine(void * args) {
 			next_slot(timer_id);
 		}
 #ifdef MM_PAGING
-		proc->mm = malloc(sizeof(struct mm_struct));
-		init_mm(proc->mm, proc);
+		mm_arena_init(&proc->arena);
+		proc->mm = mm_arena_alloc(&proc->arena, &mm_cache);
+		if (proc->mm == NULL || init_mm(proc->mm, proc) < 0) {
+			/* The mm and whatever it got go back with the arena */
+			printf("\tCannot set up the memory of a process at %s\n",
+				ld_processes.path[i]);
+			mm_arena_release(&proc->arena);
+			unload(proc);
+			free(ld_processes.path[i]);
+			i++;
+			next_slot(timer_id);
+			continue;
+		}
 		proc->mram = mram;
 		proc->mswp = mswp;
 		proc->active_mswp = active_mswp;
+		memcg_attach(proc, ld_processes.memcg[i],
+				ld_processes.rss_max[i], ld_processes.swp_max[i]);
+		oom_register(proc);
 #endif
 #ifdef CPU_TLB
 		proc->tlb = &tlb;
@@ -142,6 +203,12 @@ static void * ld_routine(void * args) {
 	}
 	free(ld_processes.path);
 	free(ld_processes.start_time);
+#ifdef MM_PAGING
+	free(ld_processes.rss_max);
+	free(ld_processes.swp_max);
+	free(ld_processes.memcg);
+	kmem_cache_drain();
+#endif
 	done = 1;
 	detach_event(timer_id);
 	pthread_exit(NULL);
@@ -196,12 +263,84 @@ static void read_config(const char * path) {
 
 	fscanf(file, "\n"); /* Final character */
 #endif
+
+	/* Optional keyword lines before the process list:
+	 *        PAGESZ PAGE_SIZE_IN_BYTES
+	 *        BUSWIDTH ADDRESS_BITS
+	 *        SWPPOLICY RR|FREE|TIER
+	 *        OOM FAIL|LARGEST|PRIO
+	 *        SWPLAT MEM_SWP0_LAT MEM_SWP1_LAT MEM_SWP2_LAT MEM_SWP3_LAT
+	 *        ZSWAP PERCENT_OF_RAM
+	 *        KSWAPD LOW_FREE_FRAMES HIGH_FREE_FRAMES
+	 *        KSM FRAMES_PER_SLOT
+	 *        LOADCTL FAULTS_PER_WINDOW LOW_FREE_FRAMES [WINDOW_SLOTS]
+	 *        SWPRA READAHEAD_PAGES
+	 *        SWPFILE MEM_SWP_INDEX HOST_PATH [PERSIST]
+	 *        RAMFILE HOST_PATH [PERSIST]
+	 */
+	char key[16], val[16], args[200];
+	while (fscanf(file, " %15[A-Z]", key) == 1) {
+		if (fgets(args, sizeof(args), file) == NULL)
+			args[0] = '\0';
+
+		if (strcmp(key, "PAGESZ") == 0) {
+			sscanf(args, "%d", &pagesz);
+		} else if (strcmp(key, "BUSWIDTH") == 0) {
+			sscanf(args, "%d", &buswidth);
+		} else if (strcmp(key, "SWPPOLICY") == 0) {
+			if (sscanf(args, "%15s", val) != 1 || swap_set_policy(val) < 0)
+				printf("Unknown swap policy, keep round-robin\n");
+		} else if (strcmp(key, "OOM") == 0) {
+			if (sscanf(args, "%15s", val) != 1 || oom_set_policy(val) < 0)
+				printf("Unknown OOM policy, keep FAIL\n");
+		} else if (strcmp(key, "SWPLAT") == 0) {
+			sscanf(args, "%d %d %d %d", &memswplat[0], &memswplat[1],
+					&memswplat[2], &memswplat[3]);
+		} else if (strcmp(key, "ZSWAP") == 0) {
+			sscanf(args, "%d", &zswappct);
+		} else if (strcmp(key, "SWPRA") == 0) {
+			if (sscanf(args, "%d", &sit) == 1)
+				swap_set_readahead(sit);
+		} else if (strcmp(key, "KSWAPD") == 0) {
+			sscanf(args, "%d %d", &kswapd_low, &kswapd_high);
+		} else if (strcmp(key, "KSM") == 0) {
+			sscanf(args, "%d", &ksm_batch);
+		} else if (strcmp(key, "LOADCTL") == 0) {
+			/* FAULTS_PER_WINDOW 0 only counts */
+			sit = 0;
+			sscanf(args, "%d %d %d", &loadctl_high, &loadctl_low, &sit);
+			loadctl_init(sit);
+		} else if (strcmp(key, "SWPFILE") == 0) {
+			val[0] = '\0';
+			if (sscanf(args, "%d", &sit) == 1 && sit >= 0 && sit < PAGING_MAX_MMSWP) {
+				sscanf(args, "%*d %99s %15s", memswpfile[sit], val);
+				memswppersist[sit] = (strcmp(val, "PERSIST") == 0);
+			}
+		} else if (strcmp(key, "RAMFILE") == 0) {
+			val[0] = '\0';
+			sscanf(args, "%99s %15s", memramfile, val);
+			memrampersist = (strcmp(val, "PERSIST") == 0);
+		} else {
+			printf("Unknown config keyword %s\n", key);
+		}
+	}
 #endif
 
 #ifdef MLQ_SCHED
 	ld_processes.prio = (unsigned long*)
 		malloc(sizeof(unsigned long) * num_processes);
 #endif
+#ifdef MM_PAGING
+	ld_processes.rss_max = (int*)calloc(num_processes, sizeof(int));
+	ld_processes.swp_max = (int*)calloc(num_processes, sizeof(int));
+	ld_processes.memcg = (int*)calloc(num_processes, sizeof(int));
+#endif
+	/* Process lines:
+	 *        START_TIME PATH [PRIORITY, MLQ_SCHED only]
+	 *            [RSS_MAX_FRAMES [SWP_MAX_PAGES [GROUP]], MM_PAGING only]
+	 * A limit of 0 is none. Processes of the same GROUP (> 0) share the
+	 * limits given with the first of them.
+	 */
 	int i;
 	for (i = 0; i < num_processes; i++) {
 		ld_processes.path[i] = (char*)malloc(sizeof(char) * 100);
@@ -209,9 +348,17 @@ static void read_config(const char * path) {
 		strcat(ld_processes.path[i], "input/proc/");
 		char proc[100];
 #ifdef MLQ_SCHED
-		fscanf(file, "%lu %s %lu\n", &ld_processes.start_time[i], proc, &ld_processes.prio[i]);
+		fscanf(file, "%lu %s %lu", &ld_processes.start_time[i], proc, &ld_processes.prio[i]);
 #else
-		fscanf(file, "%lu %s\n", &ld_processes.start_time[i], proc);
+		fscanf(file, "%lu %s", &ld_processes.start_time[i], proc);
+#endif
+#ifdef MM_PAGING
+		if (fgets(args, sizeof(args), file) == NULL)
+			args[0] = '\0';
+		sscanf(args, "%d %d %d", &ld_processes.rss_max[i],
+				&ld_processes.swp_max[i], &ld_processes.memcg[i]);
+#else
+		fscanf(file, "\n");
 #endif
 		strcat(ld_processes.path[i], proc);
 	}
@@ -241,6 +388,17 @@ int main(int argc, char * argv[]) {
 		args[i].id = i;
 	}
 	struct timer_id_t * ld_event = attach_event();
+#ifdef MM_PAGING
+	struct timer_id_t * kswapd_event = NULL;
+	if (kswapd_high > 0)
+		kswapd_event = attach_event();
+	struct timer_id_t * ksm_event = NULL;
+	if (ksm_batch > 0)
+		ksm_event = attach_event();
+	struct timer_id_t * loadctl_event = NULL;
+	if (loadctl_high > 0)
+		loadctl_event = attach_event();
+#endif
 	start_timer();
 #ifdef CPU_TLB
 
@@ -253,23 +411,53 @@ int main(int argc, char * argv[]) {
 
 	struct memphy_struct mram;
 	struct memphy_struct mswp[PAGING_MAX_MMSWP];
+	struct memphy_struct *mswpv[PAGING_MAX_MMSWP];
 
+	/* Page size and bus width are fixed before any device is created */
+	if (paging_setup(pagesz, buswidth, memramsz) < 0) {
+		printf("Unsupported page size %d or bus width %d, keep %d B / %d bits\n",
+				pagesz, buswidth, PAGING_DEFAULT_PAGESZ, PAGING_DEFAULT_BUS_WIDTH);
+		paging_setup(PAGING_DEFAULT_PAGESZ, PAGING_DEFAULT_BUS_WIDTH, memramsz);
+	}
 
-	/* Create MEM RAM */
-	init_memphy(&mram, memramsz, rdmflag);
+	/* Create MEM RAM, host file backed if configured */
+	if (memramfile[0] != '\0' &&
+	    init_memphy_file(&mram, memramsz, rdmflag, memramfile, memrampersist) == 0)
+		printf("MEMRAM mapped from %s%s\n", memramfile,
+				memrampersist ? ", kept after exit" : "");
+	else
+		init_memphy(&mram, memramsz, rdmflag);
+	if (zswappct > 0)
+		zswap_init(&mram, zswappct);
+	MEMPHY_init_pcp(&mram, num_cpus);
 
 	/* Create all MEM SWAP */ 
 	int sit;
-	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-	       init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+	       if (memswpfile[sit][0] != '\0' &&
+	           init_memphy_file(&mswp[sit], memswpsz[sit], rdmflag,
+	                            memswpfile[sit], memswppersist[sit]) == 0)
+	              printf("MEMSWP %d mapped from %s%s\n", sit, memswpfile[sit],
+	                     memswppersist[sit] ? ", kept after exit" : "");
+	       else
+	              init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	       MEMPHY_set_latency(&mswp[sit], memswplat[sit]);
+	       mswpv[sit] = &mswp[sit];
+	}
 
 	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
 	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
 
 	mm_ld_args->timer_id = ld_event;
 	mm_ld_args->mram = (struct memphy_struct *) &mram;
-	mm_ld_args->mswp = (struct memphy_struct**) &mswp;
+	mm_ld_args->mswp = mswpv;
 	mm_ld_args->active_mswp = (struct memphy_struct *) &mswp[0];
+
+	if (kswapd_event != NULL)
+		kswapd_start(&kswapd, &mram, mswpv, kswapd_event,
+				kswapd_low, kswapd_high);
+	if (ksm_event != NULL)
+		ksm_start(&mram, mswpv, ksm_event, ksm_batch);
 #endif
 
 #ifdef CPU_TLB
@@ -283,6 +471,11 @@ int main(int argc, char * argv[]) {
 
 	/* Init scheduler */
 	init_scheduler();
+#ifdef MM_PAGING
+	/* Load control works on the ready queues */
+	if (loadctl_event != NULL)
+		loadctl_start(&mram, mswpv, loadctl_event, loadctl_high, loadctl_low);
+#endif
 
 	/* Run CPU and loader */
 #ifdef MM_PAGING
@@ -290,6 +483,7 @@ int main(int argc, char * argv[]) {
 #else
 	pthread_create(&ld, NULL, ld_routine, (void*)ld_event);
 #endif
+	cpus_running = num_cpus;
 	for (i = 0; i < num_cpus; i++) {
 		pthread_create(&cpu[i], NULL,
 			cpu_routine, (void*)&args[i]);
@@ -301,6 +495,26 @@ int main(int argc, char * argv[]) {
 	}
 	pthread_join(ld, NULL);
 
+#ifdef MM_PAGING
+	if (kswapd_event != NULL)
+		kswapd_join(&kswapd);
+	if (ksm_event != NULL)
+		ksm_join();
+	if (loadctl_event != NULL)
+		loadctl_join();
+	zswap_dump();
+	swap_ra_dump();
+	oom_dump();
+	memcg_dump();
+	shm_destroy_all();
+#ifdef MMDBG
+	kmem_cache_dump();
+#endif
+	MEMPHY_destroy(&mram);
+	for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+		MEMPHY_destroy(&mswp[sit]);
+#endif
+
 	/* Stop timer */
 	stop_timer();
 
@@ -11,6 +11,8 @@ static pthread_mutex_t queue_lock;
 
 #ifdef MLQ_SCHED
 static struct queue_t mlq_ready_queue[MAX_PRIO];
+/* Deactivated by load control, oldest first */
+static struct queue_t inactive_queue;
 #endif
 
 int queue_empty(void) {
@@ -19,6 +21,8 @@ int queue_empty(void) {
 	for (prio = 0; prio < MAX_PRIO; prio++)
 		if(!empty(&mlq_ready_queue[prio])) 
 			return -1;
+	if (!empty(&inactive_queue))
+		return -1;
 #endif
 	return (empty(&ready_queue) && empty(&run_queue));
 }
@@ -31,6 +35,7 @@ void init_scheduler(void) {
 		mlq_ready_queue[i].size = 0;
 		mlq_ready_queue[i].slot = MAX_PRIO - i;
 	}
+	inactive_queue.size = 0;
 #endif
 	ready_queue.size = 0;
 	run_queue.size = 0;
@@ -73,6 +78,11 @@ struct pcb_t * get_mlq_proc(void) {
 			}
 		}
 	}
+
+	/* A CPU is not left idle by load control, with nothing else
+	 * ready it runs a deactivated process again */
+	if (proc == NULL)
+		proc = dequeue(&inactive_queue);
 	
 	pthread_mutex_unlock(&queue_lock);
 	return proc;
@@ -90,6 +100,50 @@ void add_mlq_proc(struct pcb_t * proc) {
 	pthread_mutex_unlock(&queue_lock);	
 }
 
+/*
+ *  Load control takes a ready process out of the MLQ while memory is
+ *  overcommitted: the first one @admit accepts, lowest priority first.
+ *  The running ones are left alone
+ */
+struct pcb_t * deactivate_proc(int (*admit)(struct pcb_t * proc)) {
+	struct pcb_t * proc = NULL;
+	struct queue_t * q;
+	int i, j;
+
+	pthread_mutex_lock(&queue_lock);
+	for (i = MAX_PRIO - 1; i >= 0 && proc == NULL &&
+	     inactive_queue.size < MAX_QUEUE_SIZE; i--) {
+		q = &mlq_ready_queue[i];
+		for (j = 0; j < q->size; j++) {
+			if (admit == NULL || admit(q->proc[j])) {
+				proc = q->proc[j];
+				/* The others keep their order in the queue */
+				for (q->size--; j < q->size; j++)
+					q->proc[j] = q->proc[j + 1];
+				q->proc[q->size] = NULL;
+				enqueue(&inactive_queue, proc);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&queue_lock);
+	return proc;
+}
+
+struct pcb_t * reactivate_proc(int (*admit)(struct pcb_t * proc)) {
+	struct pcb_t * proc = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+	if (!empty(&inactive_queue) &&
+	    mlq_ready_queue[inactive_queue.proc[0]->prio].size < MAX_QUEUE_SIZE &&
+	    (admit == NULL || admit(inactive_queue.proc[0]))) {
+		proc = dequeue(&inactive_queue);
+		enqueue(&mlq_ready_queue[proc->prio], proc);
+	}
+	pthread_mutex_unlock(&queue_lock);
+	return proc;
+}
+
 struct pcb_t * get_proc(void) {
 	return get_mlq_proc();
 }
@@ -121,6 +175,15 @@ void add_proc(struct pcb_t * proc) {
 	enqueue(&ready_queue, proc);
 	pthread_mutex_unlock(&queue_lock);	
 }
+
+/* No load control without the MLQ */
+struct pcb_t * deactivate_proc(int (*admit)(struct pcb_t * proc)) {
+	return NULL;
+}
+
+struct pcb_t * reactivate_proc(int (*admit)(struct pcb_t * proc)) {
+	return NULL;
+}
 #endif
 
 